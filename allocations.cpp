@@ -0,0 +1,65 @@
+#include "search_server.h"
+
+#include "benchmark_data.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+// Heap allocations made by the whole program. This benchmark gets a
+// program of its own, as counting slows down every allocation. The array
+// and nothrow forms of operator new call these two, and the default
+// operator delete in all its forms releases the memory with free. Kept out
+// of line so that GCC does not take the inlined malloc for a mismatch.
+atomic<size_t> allocation_count{0};
+
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    if (void *pointer = malloc(size))
+    {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new(size_t size, align_val_t alignment)
+{
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    const size_t alignment_size = static_cast<size_t>(alignment);
+    // aligned_alloc takes whole multiples of the alignment only.
+    if (void *pointer = aligned_alloc(alignment_size, (size + alignment_size - 1) / alignment_size * alignment_size))
+    {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+// MatchDocument spends most of its time tokenizing and parsing the query;
+// counts the heap allocations it makes per query, on the index and queries
+// of the main benchmark.
+int main()
+{
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 1000, 10);
+    const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    const auto queries = GenerateQueries(generator, dictionary, 100, 70);
+
+    const size_t allocations_before = allocation_count.load();
+    size_t matched_word_count = 0;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        matched_word_count += get<0>(search_server.MatchDocument(queries[i], i % search_server.GetDocumentCount())).size();
+    }
+    const size_t allocations = allocation_count.load() - allocations_before;
+    cout << matched_word_count << endl;
+    cerr << "match documents: "s << allocations * 1.0 / queries.size() << " allocations/query"s << endl;
+}
\ No newline at end of file
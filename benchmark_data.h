@@ -0,0 +1,21 @@
+#pragma once
+#include <random>
+#include <string>
+#include <vector>
+
+// Random words, documents and queries the benchmarks run on. The same
+// generator state yields the same data in every program.
+
+std::string GenerateWord(std::mt19937 &generator, int max_length);
+
+std::vector<std::string> GenerateDictionary(std::mt19937 &generator, int word_count, int max_length);
+
+// word_count words of dictionary; each is a minus word with probability
+// minus_prob.
+std::string GenerateQuery(std::mt19937 &generator, const std::vector<std::string> &dictionary, int word_count, double minus_prob = 0);
+
+std::vector<std::string> GenerateQueries(std::mt19937 &generator, const std::vector<std::string> &dictionary, int query_count, int max_word_count);
+
+// Queries whose words are drawn by Zipf's law: the word of rank r in
+// dictionary comes up in proportion to 1 / r, as in natural text.
+std::vector<std::string> GenerateZipfQueries(std::mt19937 &generator, const std::vector<std::string> &dictionary, int query_count, int word_count);
\ No newline at end of file
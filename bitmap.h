@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// Set of document ordinals packed into 64-bit words.
+class Bitmap
+{
+public:
+    Bitmap() = default;
+
+    explicit Bitmap(size_t size, std::pmr::memory_resource *memory_resource = std::pmr::get_default_resource())
+        : size_(size), words_((size + 63) / 64, memory_resource)
+    {
+    }
+
+    void Set(size_t position)
+    {
+        words_[position / 64] |= uint64_t{1} << (position % 64);
+    }
+
+    void Reset(size_t position)
+    {
+        words_[position / 64] &= ~(uint64_t{1} << (position % 64));
+    }
+
+    bool Test(size_t position) const
+    {
+        return (words_[position / 64] >> (position % 64)) & 1;
+    }
+
+    // The operations below work a word at a time. Positions past Size()
+    // stay unset.
+    void And(const Bitmap &other)
+    {
+        for (size_t i = 0; i < words_.size(); ++i)
+        {
+            words_[i] &= other.words_[i];
+        }
+    }
+
+    void AndNot(const Bitmap &other)
+    {
+        for (size_t i = 0; i < words_.size(); ++i)
+        {
+            words_[i] &= ~other.words_[i];
+        }
+    }
+
+    // Sets position offset + i for every position i set in other, which
+    // must fit.
+    void Or(const Bitmap &other, size_t offset = 0)
+    {
+        const size_t first_word = offset / 64;
+        const size_t shift = offset % 64;
+        for (size_t i = 0; i < other.words_.size(); ++i)
+        {
+            words_[first_word + i] |= other.words_[i] << shift;
+            if (shift != 0 && first_word + i + 1 < words_.size())
+            {
+                words_[first_word + i + 1] |= other.words_[i] >> (64 - shift);
+            }
+        }
+    }
+
+    void Flip()
+    {
+        for (uint64_t &word : words_)
+        {
+            word = ~word;
+        }
+        if (size_ % 64 != 0)
+        {
+            words_.back() &= (uint64_t{1} << (size_ % 64)) - 1;
+        }
+    }
+
+    // New positions are unset.
+    void Resize(size_t size)
+    {
+        size_ = size;
+        words_.resize((size + 63) / 64);
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+private:
+    size_t size_ = 0;
+    std::pmr::vector<uint64_t> words_;
+};
\ No newline at end of file
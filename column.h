@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+// Per-document values indexed by ordinal. The values are either owned or
+// read in place from a mapped snapshot until the first modification copies
+// them into the column.
+template <typename Type>
+class Column
+{
+public:
+    explicit Column(std::pmr::memory_resource *memory_resource = std::pmr::get_default_resource())
+        : owned_(memory_resource)
+    {
+    }
+
+    Column(const Column &) = delete;
+
+    Column &operator=(const Column &) = delete;
+
+    void Attach(std::span<const Type> values)
+    {
+        owned_.clear();
+        values_ = values;
+    }
+
+    void PushBack(const Type &value)
+    {
+        Materialize();
+        owned_.push_back(value);
+        values_ = owned_;
+    }
+
+    void Append(std::span<const Type> values)
+    {
+        Materialize();
+        owned_.insert(owned_.end(), values.begin(), values.end());
+        values_ = owned_;
+    }
+
+    const Type &operator[](size_t ordinal) const
+    {
+        return values_[ordinal];
+    }
+
+    size_t Size() const
+    {
+        return values_.size();
+    }
+
+    std::span<const Type> Values() const
+    {
+        return values_;
+    }
+
+private:
+    std::pmr::vector<Type> owned_;
+    std::span<const Type> values_;
+
+    void Materialize()
+    {
+        if (values_.data() != owned_.data())
+        {
+            owned_.assign(values_.begin(), values_.end());
+            values_ = owned_;
+        }
+    }
+};
\ No newline at end of file
@@ -1,6 +1,14 @@
 #pragma once
 #include <iostream>
 
+enum class DocumentStatus
+{
+    ACTUAL,
+    IRRELEVANT,
+    BANNED,
+    REMOVED,
+};
+
 struct Document
 {
     Document() = default;
@@ -0,0 +1,659 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+    // Tokens AppendDocument encodes before copying them to the column.
+    const size_t TOKEN_BUFFER_SIZE = 64;
+
+    std::pmr::memory_resource *SegmentMemoryResource(const std::unique_ptr<SegmentArena> &arena)
+    {
+        return arena ? arena.get() : std::pmr::get_default_resource();
+    }
+
+    // Whether word i of a phrase is at position start + i for some start,
+    // given the positions of each word in one document. The word with the
+    // fewest positions proposes the starts.
+    bool HasConsecutivePositions(const std::vector<std::vector<uint32_t>> &positions)
+    {
+        const size_t rarest = std::min_element(positions.begin(), positions.end(), [](const std::vector<uint32_t> &lhs, const std::vector<uint32_t> &rhs) {
+                                  return lhs.size() < rhs.size();
+                              }) -
+                              positions.begin();
+        for (const uint32_t rarest_position : positions[rarest])
+        {
+            if (rarest_position < rarest)
+            {
+                continue;
+            }
+            const uint32_t start = rarest_position - rarest;
+            bool consecutive = true;
+            for (size_t i = 0; i < positions.size() && consecutive; ++i)
+            {
+                consecutive = std::binary_search(positions[i].begin(), positions[i].end(), start + i);
+            }
+            if (consecutive)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+size_t EncodeToken(uint32_t token, uint8_t *bytes)
+{
+    return EncodeVarint(token == STOP_WORD_TOKEN ? 0 : token + 1, bytes);
+}
+
+void *SegmentArena::do_allocate(size_t bytes, size_t alignment)
+{
+    std::lock_guard lock(mutex_);
+    return arena_.allocate(bytes, alignment);
+}
+
+void SegmentArena::do_deallocate(void *, size_t, size_t)
+{
+}
+
+bool SegmentArena::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
+
+WriteBuffer::WriteBuffer(size_t word_capacity, bool with_tokens)
+    : postings_(word_capacity), word_capacity_(word_capacity), with_tokens_(with_tokens)
+{
+    document_ids_.reserve(WRITE_BUFFER_DOCUMENT_COUNT);
+    ratings_.reserve(WRITE_BUFFER_DOCUMENT_COUNT);
+    statuses_.reserve(WRITE_BUFFER_DOCUMENT_COUNT);
+    word_counts_.reserve(WRITE_BUFFER_DOCUMENT_COUNT);
+    if (with_tokens_)
+    {
+        token_offsets_.reserve(WRITE_BUFFER_DOCUMENT_COUNT + 1);
+        token_offsets_.push_back(0);
+        tokens_.reserve(word_capacity * VARINT_MAX_BYTES);
+    }
+}
+
+uint32_t WriteBuffer::Size() const
+{
+    return document_ids_.size();
+}
+
+bool WriteBuffer::Fits(size_t word_count) const
+{
+    return Size() < WRITE_BUFFER_DOCUMENT_COUNT && word_count_ + word_count <= word_capacity_;
+}
+
+// A document adds one posting per distinct word, complete with its count.
+void WriteBuffer::AppendDocument(int document_id, DocumentStatus status, int rating, std::span<const std::string_view> words,
+                                 std::span<const uint32_t> positions)
+{
+    const uint32_t ordinal = Size();
+    std::vector<uint32_t> tokens;
+    tokens.reserve(words.size());
+    uint32_t token_count = 0;
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        tokens.push_back(postings_.Insert(words[i]));
+        if (!with_tokens_)
+        {
+            continue;
+        }
+        uint8_t bytes[VARINT_MAX_BYTES];
+        for (; token_count < positions[i]; ++token_count)
+        {
+            tokens_.insert(tokens_.end(), bytes, bytes + EncodeToken(STOP_WORD_TOKEN, bytes));
+        }
+        tokens_.insert(tokens_.end(), bytes, bytes + EncodeToken(tokens.back(), bytes));
+        ++token_count;
+    }
+    if (with_tokens_)
+    {
+        token_offsets_.push_back(tokens_.size());
+    }
+    std::sort(tokens.begin(), tokens.end());
+    for (size_t i = 0; i < tokens.size();)
+    {
+        const size_t run_end = std::upper_bound(tokens.begin() + i, tokens.end(), tokens[i]) - tokens.begin();
+        postings_.Add(tokens[i], ordinal, run_end - i);
+        i = run_end;
+    }
+    document_ids_.push_back(document_id);
+    ratings_.push_back(rating);
+    statuses_.push_back(status);
+    word_counts_.push_back(words.size());
+    word_count_ += with_tokens_ ? token_count : words.size();
+}
+
+IndexSegment::IndexSegment(SegmentMemory memory, bool with_tokens)
+    : arena_(memory == SegmentMemory::ARENA ? std::make_unique<SegmentArena>() : nullptr),
+      postings_(SegmentMemoryResource(arena_)),
+      document_ids_(SegmentMemoryResource(arena_)), ratings_(SegmentMemoryResource(arena_)), statuses_(SegmentMemoryResource(arena_)),
+      word_counts_(SegmentMemoryResource(arena_)), documents_(SegmentMemoryResource(arena_)), token_offsets_(SegmentMemoryResource(arena_)),
+      tokens_(SegmentMemoryResource(arena_))
+{
+    if (with_tokens)
+    {
+        token_offsets_.PushBack(0);
+    }
+}
+
+IndexSegment::IndexSegment(const IndexSnapshot &snapshot)
+{
+    postings_.AttachMapped(snapshot.Section<MappedTerm>(SnapshotSection::TERMS),
+                           snapshot.Section<char>(SnapshotSection::WORDS).data(),
+                           snapshot.Section<PostingBlockHeader>(SnapshotSection::BLOCKS).data(),
+                           snapshot.Section<uint32_t>(SnapshotSection::BLOCK_DATA).data());
+    document_ids_.Attach(snapshot.Section<int>(SnapshotSection::DOCUMENT_IDS));
+    ratings_.Attach(snapshot.Section<int>(SnapshotSection::RATINGS));
+    statuses_.Attach(snapshot.Section<DocumentStatus>(SnapshotSection::STATUSES));
+    word_counts_.Attach(snapshot.Section<uint32_t>(SnapshotSection::WORD_COUNTS));
+    documents_.Attach(snapshot.Section<SnapshotDocument>(SnapshotSection::DOCUMENTS));
+    token_offsets_.Attach(snapshot.Section<uint64_t>(SnapshotSection::TOKEN_OFFSETS));
+    tokens_.Attach(snapshot.Section<uint8_t>(SnapshotSection::TOKENS));
+    size_ = document_ids_.Size();
+}
+
+IndexSegment::IndexSegment(std::shared_ptr<const WriteBuffer> buffer)
+    : buffer_(std::move(buffer)), size_(buffer_->Size())
+{
+    postings_.AttachBuffered(&buffer_->postings_, size_);
+    document_ids_.Attach(buffer_->document_ids_);
+    ratings_.Attach(buffer_->ratings_);
+    statuses_.Attach(buffer_->statuses_);
+    word_counts_.Attach(buffer_->word_counts_);
+    token_offsets_.Attach(buffer_->token_offsets_);
+    tokens_.Attach(buffer_->tokens_);
+    IndexDocumentIds();
+}
+
+uint32_t IndexSegment::Size() const
+{
+    return size_;
+}
+
+SegmentMemory IndexSegment::Memory() const
+{
+    return arena_ ? SegmentMemory::ARENA : SegmentMemory::HEAP;
+}
+
+bool IndexSegment::HasTokens() const
+{
+    return token_offsets_.Size() != 0;
+}
+
+int IndexSegment::Level() const
+{
+    int level = 0;
+    for (uint64_t limit = SEGMENT_MERGE_FACTOR; size_ >= limit; limit *= SEGMENT_MERGE_FACTOR)
+    {
+        ++level;
+    }
+    return level;
+}
+
+PostingListView IndexSegment::Find(std::string_view word) const
+{
+    return postings_.Find(word);
+}
+
+InvertedIndex &IndexSegment::Postings()
+{
+    return postings_;
+}
+
+const InvertedIndex &IndexSegment::Postings() const
+{
+    return postings_;
+}
+
+int IndexSegment::DocumentId(uint32_t ordinal) const
+{
+    return document_ids_[ordinal];
+}
+
+int IndexSegment::Rating(uint32_t ordinal) const
+{
+    return ratings_[ordinal];
+}
+
+DocumentStatus IndexSegment::Status(uint32_t ordinal) const
+{
+    return statuses_[ordinal];
+}
+
+uint32_t IndexSegment::WordCount(uint32_t ordinal) const
+{
+    return word_counts_[ordinal];
+}
+
+void IndexSegment::AppendDocument(int document_id, DocumentStatus status, int rating, uint32_t word_count, std::span<const uint32_t> tokens)
+{
+    document_ids_.PushBack(document_id);
+    ratings_.PushBack(rating);
+    statuses_.PushBack(status);
+    word_counts_.PushBack(word_count);
+    ++size_;
+    if (!HasTokens())
+    {
+        return;
+    }
+    uint8_t bytes[TOKEN_BUFFER_SIZE * VARINT_MAX_BYTES];
+    size_t size = 0;
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        size += EncodeToken(tokens[i], bytes + size);
+        if ((i + 1) % TOKEN_BUFFER_SIZE == 0 || i + 1 == tokens.size())
+        {
+            tokens_.Append(std::span<const uint8_t>(bytes, size));
+            size = 0;
+        }
+    }
+    token_offsets_.PushBack(tokens_.Size());
+}
+
+void IndexSegment::DecodeTokens(uint32_t ordinal, std::vector<uint32_t> &tokens) const
+{
+    tokens.clear();
+    const uint8_t *bytes = tokens_.Values().data() + token_offsets_[ordinal];
+    const uint8_t *end = tokens_.Values().data() + token_offsets_[ordinal + 1];
+    while (bytes != end)
+    {
+        uint32_t token;
+        bytes = DecodeVarint(bytes, token);
+        tokens.push_back(token == 0 ? STOP_WORD_TOKEN : token - 1);
+    }
+}
+
+void IndexSegment::IndexDocumentIds()
+{
+    std::vector<SnapshotDocument> documents;
+    documents.reserve(size_);
+    for (uint32_t ordinal = 0; ordinal < size_; ++ordinal)
+    {
+        documents.push_back({DocumentId(ordinal), ordinal});
+    }
+    std::sort(documents.begin(), documents.end(), [](const SnapshotDocument &lhs, const SnapshotDocument &rhs) {
+        return lhs.id < rhs.id;
+    });
+    documents_.Attach({});
+    documents_.Append(documents);
+}
+
+std::span<const SnapshotDocument> IndexSegment::FindDocuments(int document_id) const
+{
+    const auto [first, last] = std::equal_range(documents_.Values().begin(), documents_.Values().end(), SnapshotDocument{document_id, 0},
+                                                [](const SnapshotDocument &lhs, const SnapshotDocument &rhs) {
+                                                    return lhs.id < rhs.id;
+                                                });
+    return std::span<const SnapshotDocument>(first, last);
+}
+
+std::span<const TermFreq> IndexSegment::MaxTermFreqs(std::string_view word) const
+{
+    std::call_once(max_term_freqs_computed_, &IndexSegment::ComputeMaxTermFreqs, this);
+    const auto it = word_to_max_term_freqs_.find(word);
+    return it == word_to_max_term_freqs_.end() ? std::span<const TermFreq>() : std::span<const TermFreq>(it->second);
+}
+
+void IndexSegment::ComputeMaxTermFreqs() const
+{
+    postings_.ForEachTerm([this](std::string_view word, const PostingListView &view) {
+        PostingCursor cursor(view);
+        std::vector<TermFreq> &max_term_freqs = word_to_max_term_freqs_[word];
+        max_term_freqs.assign(cursor.BlockCount(), TermFreq());
+        for (; !cursor.AtEnd(); cursor.Next())
+        {
+            TermFreq &max_term_freq = max_term_freqs[cursor.BlockIndex()];
+            const TermFreq term_freq{cursor.TermCount(), WordCount(cursor.Ordinal())};
+            // Compares the fractions exactly.
+            if (uint64_t{term_freq.term_count} * max_term_freq.document_length > uint64_t{max_term_freq.term_count} * term_freq.document_length)
+            {
+                max_term_freq = term_freq;
+            }
+        }
+    });
+}
+
+const Bitmap &IndexSegment::StatusDocuments(DocumentStatus status) const
+{
+    std::call_once(status_documents_computed_, &IndexSegment::ComputeStatusDocuments, this);
+    return status_documents_[static_cast<size_t>(status)];
+}
+
+void IndexSegment::ComputeStatusDocuments() const
+{
+    status_documents_.assign(static_cast<size_t>(DocumentStatus::REMOVED) + 1, Bitmap(size_));
+    for (uint32_t ordinal = 0; ordinal < size_; ++ordinal)
+    {
+        status_documents_[static_cast<size_t>(Status(ordinal))].Set(ordinal);
+    }
+}
+
+Bitmap IndexSegment::RatingDocuments(int min_rating, int max_rating) const
+{
+    Bitmap documents(size_);
+    for (uint32_t ordinal = 0; ordinal < size_; ++ordinal)
+    {
+        const int rating = Rating(ordinal);
+        if (rating >= min_rating && rating <= max_rating)
+        {
+            documents.Set(ordinal);
+        }
+    }
+    return documents;
+}
+
+void IndexSegment::DecodePositions(uint32_t ordinal, std::span<const std::string_view> words, std::vector<std::vector<uint32_t>> &positions) const
+{
+    std::vector<uint32_t> tokens;
+    DecodePositions(ordinal, TermIndexes(words), tokens, positions);
+}
+
+std::vector<uint32_t> IndexSegment::TermIndexes(std::span<const std::string_view> words) const
+{
+    std::vector<uint32_t> term_indexes(words.size(), NO_TOKEN);
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        if (words[i].empty())
+        {
+            term_indexes[i] = STOP_WORD_TOKEN;
+        }
+        else
+        {
+            postings_.FindTermIndex(words[i], term_indexes[i]);
+        }
+    }
+    return term_indexes;
+}
+
+void IndexSegment::DecodePositions(uint32_t ordinal, std::span<const uint32_t> term_indexes, std::vector<uint32_t> &tokens,
+                                   std::vector<std::vector<uint32_t>> &positions) const
+{
+    positions.resize(term_indexes.size());
+    for (std::vector<uint32_t> &term_positions : positions)
+    {
+        term_positions.clear();
+    }
+    DecodeTokens(ordinal, tokens);
+    for (uint32_t position = 0; position < tokens.size(); ++position)
+    {
+        for (size_t i = 0; i < term_indexes.size(); ++i)
+        {
+            if (tokens[position] == term_indexes[i])
+            {
+                positions[i].push_back(position);
+            }
+        }
+    }
+}
+
+// The other words are skipped to each document of the rarest one, so a
+// document is decoded only once it is known to hold every word. Stop words
+// have no postings and are only checked in the positions.
+std::vector<uint32_t> IndexSegment::FindPhrase(std::span<const std::string_view> phrase) const
+{
+    if (!HasTokens())
+    {
+        return {};
+    }
+    std::vector<PostingListView> word_postings;
+    for (const std::string_view word : phrase)
+    {
+        if (word.empty())
+        {
+            continue;
+        }
+        word_postings.push_back(postings_.Find(word));
+        if (word_postings.back().Empty())
+        {
+            return {};
+        }
+    }
+    if (word_postings.empty())
+    {
+        return {};
+    }
+    const std::vector<uint32_t> term_indexes = TermIndexes(phrase);
+    const size_t rarest = std::min_element(word_postings.begin(), word_postings.end(), [](const PostingListView &lhs, const PostingListView &rhs) {
+                              return lhs.Size() < rhs.Size();
+                          }) -
+                          word_postings.begin();
+    std::vector<PostingCursor> cursors;
+    cursors.reserve(word_postings.size());
+    for (const PostingListView &postings : word_postings)
+    {
+        cursors.emplace_back(postings);
+    }
+    std::vector<uint32_t> ordinals;
+    std::vector<uint32_t> tokens;
+    std::vector<std::vector<uint32_t>> positions;
+    for (PostingCursor &rarest_cursor = cursors[rarest]; !rarest_cursor.AtEnd(); rarest_cursor.Next())
+    {
+        const uint32_t ordinal = rarest_cursor.Ordinal();
+        bool contains_all = true;
+        for (size_t i = 0; i < cursors.size() && contains_all; ++i)
+        {
+            if (i == rarest)
+            {
+                continue;
+            }
+            cursors[i].SkipTo(ordinal);
+            if (cursors[i].AtEnd())
+            {
+                return ordinals;
+            }
+            contains_all = cursors[i].Ordinal() == ordinal;
+        }
+        if (!contains_all)
+        {
+            continue;
+        }
+        DecodePositions(ordinal, term_indexes, tokens, positions);
+        if (HasConsecutivePositions(positions))
+        {
+            ordinals.push_back(ordinal);
+        }
+    }
+    return ordinals;
+}
+
+bool IndexSegment::ContainsPhrase(std::span<const std::string_view> phrase, uint32_t ordinal) const
+{
+    if (!HasTokens())
+    {
+        return false;
+    }
+    std::vector<std::vector<uint32_t>> positions;
+    DecodePositions(ordinal, phrase, positions);
+    return HasConsecutivePositions(positions);
+}
+
+uint32_t RemovedWordCounts::Count(std::string_view word) const
+{
+    if (buckets_.empty() || !buckets_[BucketIndex(word)])
+    {
+        return 0;
+    }
+    const Bucket &bucket = *buckets_[BucketIndex(word)];
+    const auto it = std::lower_bound(bucket.begin(), bucket.end(), word, [](const auto &entry, std::string_view value) {
+        return entry.first < value;
+    });
+    return it != bucket.end() && it->first == word ? it->second : 0;
+}
+
+std::shared_ptr<const RemovedWordCounts> RemovedWordCounts::WithRemoved(const std::vector<std::string_view> &words) const
+{
+    auto counts = std::make_shared<RemovedWordCounts>(*this);
+    if (counts->buckets_.empty())
+    {
+        counts->buckets_.resize(BUCKET_COUNT);
+    }
+    std::bitset<BUCKET_COUNT> copied;
+    for (const std::string_view word : words)
+    {
+        const size_t bucket_index = BucketIndex(word);
+        std::shared_ptr<Bucket> &bucket = counts->buckets_[bucket_index];
+        if (!copied[bucket_index])
+        {
+            bucket = bucket ? std::make_shared<Bucket>(*bucket) : std::make_shared<Bucket>();
+            copied[bucket_index] = true;
+        }
+        const auto it = std::lower_bound(bucket->begin(), bucket->end(), word, [](const auto &entry, std::string_view value) {
+            return entry.first < value;
+        });
+        if (it != bucket->end() && it->first == word)
+        {
+            ++it->second;
+        }
+        else
+        {
+            bucket->insert(it, {word, 1});
+        }
+    }
+    return counts;
+}
+
+std::shared_ptr<const RemovedWordCounts> RemovedWordCounts::FromCounts(const std::unordered_map<std::string_view, uint32_t> &word_counts)
+{
+    auto counts = std::make_shared<RemovedWordCounts>();
+    std::vector<Bucket> buckets(BUCKET_COUNT);
+    for (const auto &[word, count] : word_counts)
+    {
+        buckets[BucketIndex(word)].emplace_back(word, count);
+    }
+    for (Bucket &bucket : buckets)
+    {
+        std::sort(bucket.begin(), bucket.end());
+        counts->buckets_.push_back(std::make_shared<Bucket>(std::move(bucket)));
+    }
+    return counts;
+}
+
+size_t RemovedWordCounts::BucketIndex(std::string_view word)
+{
+    return std::hash<std::string_view>{}(word) % BUCKET_COUNT;
+}
+
+PublishedSegment PublishSegment(std::shared_ptr<const IndexSegment> segment, uint32_t first_ordinal)
+{
+    auto tombstones = std::make_shared<const Bitmap>(segment->Size());
+    return {std::move(segment), first_ordinal, std::move(tombstones), 0, nullptr};
+}
+
+// The live documents of each segment are renumbered in order after those
+// of the segments before it, which keeps every posting list sorted.
+std::shared_ptr<const IndexSegment> MergeSegments(std::span<const PublishedSegment> segments)
+{
+    const bool any_arena = std::any_of(segments.begin(), segments.end(), [](const PublishedSegment &published) {
+        return published.segment->Memory() == SegmentMemory::ARENA;
+    });
+    const bool all_tokens = std::all_of(segments.begin(), segments.end(), [](const PublishedSegment &published) {
+        return published.segment->HasTokens();
+    });
+    auto merged = std::make_shared<IndexSegment>(any_arena ? SegmentMemory::ARENA : SegmentMemory::HEAP, all_tokens);
+    std::vector<Posting> live_postings;
+    std::vector<uint32_t> new_ordinals;
+    std::vector<uint32_t> tokens;
+    for (const PublishedSegment &published : segments)
+    {
+        const IndexSegment &segment = *published.segment;
+        new_ordinals.assign(segment.Size(), NO_TOKEN);
+        for (uint32_t ordinal = 0, new_ordinal = merged->Size(); ordinal < segment.Size(); ++ordinal)
+        {
+            if (!published.IsRemoved(ordinal))
+            {
+                new_ordinals[ordinal] = new_ordinal++;
+            }
+        }
+        // Only words with live postings need a merged term index.
+        std::vector<uint32_t> merged_tokens(segment.Postings().TermCount(), NO_TOKEN);
+        segment.Postings().ForEachIndexedTerm([&](uint32_t term_index, std::string_view word, const PostingListView &postings) {
+            live_postings.clear();
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                if (!published.IsRemoved(ordinal))
+                {
+                    live_postings.push_back({new_ordinals[ordinal], term_count});
+                }
+            });
+            if (live_postings.empty())
+            {
+                return;
+            }
+            IndexedTerm &merged_term = merged->Postings().Insert(word);
+            merged_tokens[term_index] = merged_term.index;
+            for (const Posting &posting : live_postings)
+            {
+                merged_term.postings.Add(posting.document_ordinal, posting.term_count);
+            }
+        });
+        for (uint32_t ordinal = 0; ordinal < segment.Size(); ++ordinal)
+        {
+            if (published.IsRemoved(ordinal))
+            {
+                continue;
+            }
+            tokens.clear();
+            if (all_tokens)
+            {
+                segment.DecodeTokens(ordinal, tokens);
+            }
+            for (uint32_t &token : tokens)
+            {
+                if (token != STOP_WORD_TOKEN)
+                {
+                    token = merged_tokens[token];
+                }
+            }
+            merged->AppendDocument(segment.DocumentId(ordinal), segment.Status(ordinal), segment.Rating(ordinal), segment.WordCount(ordinal), tokens);
+        }
+    }
+    merged->IndexDocumentIds();
+    return merged;
+}
+
+std::shared_ptr<const Bitmap> MergeTombstones(std::span<const PublishedSegment> merged, std::span<const PublishedSegment> current)
+{
+    uint32_t size = 0;
+    for (const PublishedSegment &published : merged)
+    {
+        size += published.segment->Size();
+    }
+    auto tombstones = std::make_shared<Bitmap>(size);
+    uint32_t new_ordinal = 0;
+    for (size_t i = 0; i < merged.size(); ++i)
+    {
+        for (uint32_t ordinal = 0; ordinal < merged[i].segment->Size(); ++ordinal)
+        {
+            if (merged[i].IsRemoved(ordinal))
+            {
+                continue;
+            }
+            if (current[i].IsRemoved(ordinal))
+            {
+                tombstones->Set(new_ordinal);
+            }
+            ++new_ordinal;
+        }
+    }
+    tombstones->Resize(new_ordinal);
+    return tombstones;
+}
+
+std::shared_ptr<const RemovedWordCounts> CountRemovedWords(const IndexSegment &segment, const Bitmap &tombstones)
+{
+    std::unordered_map<std::string_view, uint32_t> word_counts;
+    segment.Postings().ForEachTerm([&](std::string_view word, const PostingListView &postings) {
+        postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+            if (tombstones.Test(ordinal))
+            {
+                ++word_counts[word];
+            }
+        });
+    });
+    return RemovedWordCounts::FromCounts(word_counts);
+}
\ No newline at end of file
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bitmap.h"
+#include "column.h"
+#include "document.h"
+#include "index_snapshot.h"
+#include "inverted_index.h"
+
+// Merges producing segments smaller than this run on the writing thread,
+// larger ones on the background merger.
+static const uint32_t SEGMENT_FOREGROUND_MERGE_LIMIT = 4096;
+
+static const int SEGMENT_MERGE_FACTOR = 4;
+
+static const uint32_t NO_TOKEN = UINT32_MAX;
+
+// Token of a stop word: it has no term index, but keeps its place in the
+// token stream.
+static const uint32_t STOP_WORD_TOKEN = UINT32_MAX - 1;
+
+// Documents a write buffer takes before it is left to the merges. Their
+// postings are viewed as uncompressed tails, which caps it.
+static const uint32_t WRITE_BUFFER_DOCUMENT_COUNT = 64;
+
+static_assert(WRITE_BUFFER_DOCUMENT_COUNT <= POSTING_BLOCK_SIZE);
+
+// Words a write buffer takes unless a single longer document needs more;
+// stop words count only if the buffer keeps token streams.
+static const size_t WRITE_BUFFER_WORD_COUNT = 8192;
+
+// Where a segment allocates its postings and columns from. An arena
+// segment never frees memory piecemeal: everything goes at once with the
+// segment, at the cost of keeping the buffers outgrown while it was built.
+enum class SegmentMemory
+{
+    HEAP,
+    ARENA,
+};
+
+// Appends a token to a token stream: 0 for a stop word, the term index
+// plus one for any other word, as a varint. Returns the bytes written.
+size_t EncodeToken(uint32_t token, uint8_t *bytes);
+
+// Monotonic arena that can be allocated from by several threads, as the
+// posting lists of a batch are filled in parallel.
+class SegmentArena : public std::pmr::memory_resource
+{
+private:
+    std::mutex mutex_;
+    std::pmr::monotonic_buffer_resource arena_;
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *pointer, size_t bytes, size_t alignment) override;
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+};
+
+// Documents added one at a time. The writer appends to a buffer in place,
+// past the documents already published, and every version serves those it
+// covers through a segment viewing the buffer; adding a document neither
+// builds a segment of its own nor merges one.
+class WriteBuffer
+{
+public:
+    // Takes documents of up to word_capacity words in all, counted as by
+    // Fits; with_tokens keeps the token stream of each document.
+    WriteBuffer(size_t word_capacity, bool with_tokens);
+
+    uint32_t Size() const;
+
+    // Whether one more document of word_count words fits. A buffer keeping
+    // token streams counts the stop words up to the last word too.
+    bool Fits(size_t word_count) const;
+
+    // words are the words of the document in order, stop words left out;
+    // they are stored by reference. positions are their places in the
+    // document, stop words counted, and are read only if the buffer keeps
+    // token streams.
+    void AppendDocument(int document_id, DocumentStatus status, int rating, std::span<const std::string_view> words,
+                        std::span<const uint32_t> positions);
+
+private:
+    friend class IndexSegment;
+
+    BufferedPostings postings_;
+    size_t word_capacity_;
+    bool with_tokens_;
+    size_t word_count_ = 0;
+    // Reserved up front and never reallocated, as readers hold pointers
+    // into them.
+    std::vector<int> document_ids_;
+    std::vector<int> ratings_;
+    std::vector<DocumentStatus> statuses_;
+    std::vector<uint32_t> word_counts_;
+    std::vector<uint64_t> token_offsets_;
+    std::vector<uint8_t> tokens_;
+};
+
+// Term count of a word in a document and the length of the document.
+struct TermFreq
+{
+    uint32_t term_count = 0;
+    uint32_t document_length = 1;
+};
+
+// Postings and metadata of the documents with ordinals in [0, Size()),
+// numbered within the segment. A segment is built once and never modified
+// after it has been published; removals are tracked outside of it.
+class IndexSegment
+{
+public:
+    // with_tokens keeps the token stream of each document, which phrase
+    // search and DecodePositions need.
+    explicit IndexSegment(SegmentMemory memory = SegmentMemory::HEAP, bool with_tokens = false);
+
+    // Serves the postings and metadata of a snapshot in place.
+    explicit IndexSegment(const IndexSnapshot &snapshot);
+
+    // Serves the documents appended to buffer so far in place.
+    explicit IndexSegment(std::shared_ptr<const WriteBuffer> buffer);
+
+    uint32_t Size() const;
+
+    // Segments of one level hold a similar number of ordinals; merging
+    // SEGMENT_MERGE_FACTOR segments of one level yields the next level.
+    int Level() const;
+
+    SegmentMemory Memory() const;
+
+    bool HasTokens() const;
+
+    PostingListView Find(std::string_view word) const;
+
+    InvertedIndex &Postings();
+
+    const InvertedIndex &Postings() const;
+
+    int DocumentId(uint32_t ordinal) const;
+
+    int Rating(uint32_t ordinal) const;
+
+    DocumentStatus Status(uint32_t ordinal) const;
+
+    uint32_t WordCount(uint32_t ordinal) const;
+
+    // Takes the next ordinal; its postings are added through Postings().
+    // tokens are the words of the document in order as term indexes of
+    // Postings(), STOP_WORD_TOKEN for stop words; they are ignored by a
+    // segment without token streams.
+    void AppendDocument(int document_id, DocumentStatus status, int rating, uint32_t word_count, std::span<const uint32_t> tokens);
+
+    // The segment must have token streams.
+    void DecodeTokens(uint32_t ordinal, std::vector<uint32_t> &tokens) const;
+
+    // Sorts the id index once all documents have been appended.
+    void IndexDocumentIds();
+
+    // Ordinals of document_id in this segment, including removed ones.
+    std::span<const SnapshotDocument> FindDocuments(int document_id) const;
+
+    // Term count and document length of the posting with the largest term
+    // frequency in each block of the postings of word, indexed like the
+    // blocks of a PostingCursor; empty if the word is not indexed. Computed
+    // for all words of the segment on first use, so the segment must have
+    // been published.
+    std::span<const TermFreq> MaxTermFreqs(std::string_view word) const;
+
+    // Documents with status, removed ones included, indexed by ordinal.
+    // Computed for every status on first use, so the segment must have
+    // been published.
+    const Bitmap &StatusDocuments(DocumentStatus status) const;
+
+    // Documents rated within [min_rating, max_rating], indexed like
+    // StatusDocuments.
+    Bitmap RatingDocuments(int min_rating, int max_rating) const;
+
+    // Sets positions[i] to the ascending positions of words[i] in the
+    // document, empty if it lacks the word; an empty word stands for any
+    // stop word. Positions count the words of a document, stop words
+    // included, and are decoded from its token stream, so the segment must
+    // have token streams.
+    void DecodePositions(uint32_t ordinal, std::span<const std::string_view> words, std::vector<std::vector<uint32_t>> &positions) const;
+
+    // Ascending ordinals of the documents, removed ones included, where the
+    // words of phrase follow each other, an empty word matching any stop
+    // word. The postings of the rarest word drive the search, and only the
+    // documents holding every word have their positions decoded. Empty if
+    // the segment has no token streams.
+    std::vector<uint32_t> FindPhrase(std::span<const std::string_view> phrase) const;
+
+    // Whether FindPhrase would list ordinal.
+    bool ContainsPhrase(std::span<const std::string_view> phrase, uint32_t ordinal) const;
+
+private:
+    // Declared first so that it outlives the containers allocating from it.
+    std::unique_ptr<SegmentArena> arena_;
+    std::shared_ptr<const WriteBuffer> buffer_;
+    InvertedIndex postings_;
+    uint32_t size_ = 0;
+    Column<int> document_ids_;
+    Column<int> ratings_;
+    Column<DocumentStatus> statuses_;
+    Column<uint32_t> word_counts_;
+    Column<SnapshotDocument> documents_;
+    // Token streams: the tokens of document i as encoded by EncodeToken,
+    // from offset i to offset i + 1. No offsets at all if the segment does
+    // not keep the streams.
+    Column<uint64_t> token_offsets_;
+    Column<uint8_t> tokens_;
+    mutable std::once_flag max_term_freqs_computed_;
+    mutable std::unordered_map<std::string_view, std::vector<TermFreq>> word_to_max_term_freqs_;
+    mutable std::once_flag status_documents_computed_;
+    mutable std::vector<Bitmap> status_documents_;
+
+    void ComputeMaxTermFreqs() const;
+
+    void ComputeStatusDocuments() const;
+
+    // Term indexes of words, STOP_WORD_TOKEN for empty ones and NO_TOKEN
+    // for those not indexed.
+    std::vector<uint32_t> TermIndexes(std::span<const std::string_view> words) const;
+
+    void DecodePositions(uint32_t ordinal, std::span<const uint32_t> term_indexes, std::vector<uint32_t> &tokens,
+                         std::vector<std::vector<uint32_t>> &positions) const;
+};
+
+// Number of removed documents containing each word, counted over the
+// removals whose postings are still in a segment. Words are spread over
+// buckets; a copy shares the buckets it does not modify, so a removal only
+// copies the buckets of its words.
+class RemovedWordCounts
+{
+public:
+    uint32_t Count(std::string_view word) const;
+
+    // Counts one more removed document containing each of the distinct
+    // words. The words must outlive the counts.
+    std::shared_ptr<const RemovedWordCounts> WithRemoved(const std::vector<std::string_view> &words) const;
+
+    static std::shared_ptr<const RemovedWordCounts> FromCounts(const std::unordered_map<std::string_view, uint32_t> &word_counts);
+
+private:
+    static const size_t BUCKET_COUNT = 256;
+
+    // Sorted by word.
+    using Bucket = std::vector<std::pair<std::string_view, uint32_t>>;
+
+    // Buckets are not modified once the counts are published.
+    std::vector<std::shared_ptr<Bucket>> buckets_;
+
+    static size_t BucketIndex(std::string_view word);
+};
+
+// A segment together with the removals published for it and its place in
+// the ordinals of a version.
+struct PublishedSegment
+{
+    std::shared_ptr<const IndexSegment> segment;
+    // Ordinal of the first document of the segment in the version; the
+    // ordinals of the segment follow from there.
+    uint32_t first_ordinal = 0;
+    // Indexed by the ordinals of the segment; replaced, never modified.
+    std::shared_ptr<const Bitmap> tombstones;
+    // Removed documents whose postings are still in the segment.
+    uint32_t pending_removals = 0;
+    // Null while there are no pending removals; replaced, never modified.
+    std::shared_ptr<const RemovedWordCounts> removed_word_counts;
+
+    bool IsRemoved(uint32_t ordinal) const
+    {
+        return tombstones->Test(ordinal);
+    }
+
+    uint32_t EndOrdinal() const
+    {
+        return first_ordinal + segment->Size();
+    }
+
+    // Number of live documents among the postings of word in the segment.
+    uint32_t CountLiveDocuments(std::string_view word, const PostingListView &postings) const
+    {
+        return postings.Size() - (removed_word_counts ? removed_word_counts->Count(word) : 0);
+    }
+};
+
+PublishedSegment PublishSegment(std::shared_ptr<const IndexSegment> segment, uint32_t first_ordinal);
+
+// Concatenates adjacent segments, given in ordinal order, and leaves their
+// removed documents out. The merge is built in an arena if any of the
+// segments is, and keeps token streams if all of them do.
+std::shared_ptr<const IndexSegment> MergeSegments(std::span<const PublishedSegment> segments);
+
+// Tombstones of the merge of merged for the documents removed since it
+// started. current holds the same segments as merged, with the removals
+// published in the meantime.
+std::shared_ptr<const Bitmap> MergeTombstones(std::span<const PublishedSegment> merged, std::span<const PublishedSegment> current);
+
+// Counts the words of the removed documents whose postings are in segment.
+std::shared_ptr<const RemovedWordCounts> CountRemovedWords(const IndexSegment &segment, const Bitmap &tombstones);
\ No newline at end of file
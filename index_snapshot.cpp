@@ -0,0 +1,139 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index_snapshot.h"
+
+using namespace std::string_literals;
+
+namespace
+{
+    const char SNAPSHOT_MAGIC[8] = {'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P'};
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t section_count;
+    };
+
+    uint64_t AlignSection(uint64_t offset)
+    {
+        return (offset + 7) / 8 * 8;
+    }
+}
+
+IndexSnapshot::IndexSnapshot(const std::string &path)
+{
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        throw std::runtime_error("Cannot open snapshot "s + path);
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(SnapshotHeader)))
+    {
+        close(file);
+        throw std::runtime_error("Snapshot "s + path + " is truncated"s);
+    }
+    size_ = file_stat.st_size;
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (data_ == MAP_FAILED)
+    {
+        data_ = nullptr;
+        throw std::runtime_error("Cannot map snapshot "s + path);
+    }
+
+    const auto *header = static_cast<const SnapshotHeader *>(data_);
+    const size_t section_count = header->version == SNAPSHOT_VERSION_WITHOUT_TOKENS ? static_cast<size_t>(SnapshotSection::TOKEN_OFFSETS)
+                                                                                    : static_cast<size_t>(SnapshotSection::COUNT);
+    const size_t table_end = sizeof(SnapshotHeader) + section_count * sizeof(SnapshotSectionEntry);
+    std::string error;
+    if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        error = "Snapshot "s + path + " has no snapshot header"s;
+    }
+    else if ((header->version != SNAPSHOT_VERSION && header->version != SNAPSHOT_VERSION_WITHOUT_TOKENS) || header->section_count != section_count)
+    {
+        error = "Snapshot "s + path + " has unsupported version "s + std::to_string(header->version);
+    }
+    else if (size_ < table_end)
+    {
+        error = "Snapshot "s + path + " is truncated"s;
+    }
+    else
+    {
+        sections_ = reinterpret_cast<const SnapshotSectionEntry *>(static_cast<const char *>(data_) + sizeof(SnapshotHeader));
+        for (size_t i = 0; i < section_count; ++i)
+        {
+            if (sections_[i].offset % 8 != 0 || sections_[i].offset > size_ || sections_[i].size > size_ - sections_[i].offset)
+            {
+                error = "Snapshot "s + path + " is truncated"s;
+            }
+        }
+        section_count_ = section_count;
+    }
+    if (!error.empty())
+    {
+        munmap(data_, size_);
+        data_ = nullptr;
+        throw std::runtime_error(error);
+    }
+}
+
+IndexSnapshot::~IndexSnapshot()
+{
+    if (data_ != nullptr)
+    {
+        munmap(data_, size_);
+    }
+}
+
+SnapshotWriter::SnapshotWriter()
+    : sections_(static_cast<size_t>(SnapshotSection::COUNT))
+{
+}
+
+void SnapshotWriter::Write(const std::string &path) const
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw std::runtime_error("Cannot create snapshot "s + path);
+    }
+
+    const bool with_tokens = !sections_[static_cast<size_t>(SnapshotSection::TOKEN_OFFSETS)].empty();
+    const size_t section_count = with_tokens ? sections_.size() : static_cast<size_t>(SnapshotSection::TOKEN_OFFSETS);
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = with_tokens ? SNAPSHOT_VERSION : SNAPSHOT_VERSION_WITHOUT_TOKENS;
+    header.section_count = section_count;
+    std::vector<SnapshotSectionEntry> entries(section_count);
+    uint64_t offset = AlignSection(sizeof(SnapshotHeader) + entries.size() * sizeof(SnapshotSectionEntry));
+    for (size_t i = 0; i < section_count; ++i)
+    {
+        entries[i] = {offset, sections_[i].size()};
+        offset = AlignSection(offset + sections_[i].size());
+    }
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(SnapshotSectionEntry));
+    uint64_t position = sizeof(header) + entries.size() * sizeof(SnapshotSectionEntry);
+    const char padding[8] = {};
+    for (size_t i = 0; i < section_count; ++i)
+    {
+        out.write(padding, entries[i].offset - position);
+        out.write(sections_[i].data(), sections_[i].size());
+        position = entries[i].offset + sections_[i].size();
+    }
+    if (!out)
+    {
+        throw std::runtime_error("Cannot write snapshot "s + path);
+    }
+}
\ No newline at end of file
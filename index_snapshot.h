@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+static const uint32_t SNAPSHOT_VERSION = 2;
+
+// Snapshots without token streams keep the format of version 1, whose
+// sections end before TOKEN_OFFSETS.
+static const uint32_t SNAPSHOT_VERSION_WITHOUT_TOKENS = 1;
+
+enum class SnapshotSection
+{
+    STOP_WORDS,
+    TERMS,
+    WORDS,
+    BLOCKS,
+    BLOCK_DATA,
+    DOCUMENT_IDS,
+    RATINGS,
+    STATUSES,
+    WORD_COUNTS,
+    DOCUMENTS,
+    TOKEN_OFFSETS,
+    TOKENS,
+    COUNT,
+};
+
+// Live document of a snapshot; the array is sorted by id.
+struct SnapshotDocument
+{
+    int32_t id;
+    uint32_t ordinal;
+};
+
+struct SnapshotSectionEntry
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Read-only memory mapping of a snapshot file. The file starts with a magic
+// string, the format version and a table of 8-byte aligned sections.
+class IndexSnapshot
+{
+public:
+    explicit IndexSnapshot(const std::string &path);
+
+    IndexSnapshot(const IndexSnapshot &) = delete;
+
+    IndexSnapshot &operator=(const IndexSnapshot &) = delete;
+
+    ~IndexSnapshot();
+
+    template <typename Type>
+    std::span<const Type> Section(SnapshotSection section) const;
+
+private:
+    void *data_ = nullptr;
+    size_t size_ = 0;
+    const SnapshotSectionEntry *sections_ = nullptr;
+    size_t section_count_ = 0;
+};
+
+class SnapshotWriter
+{
+public:
+    SnapshotWriter();
+
+    template <typename Type>
+    void SetSection(SnapshotSection section, std::span<const Type> values);
+
+    // Writes the format of version 1 if the token sections are empty.
+    void Write(const std::string &path) const;
+
+private:
+    std::vector<std::vector<char>> sections_;
+};
+
+// Sections the format of the snapshot lacks are empty.
+template <typename Type>
+std::span<const Type> IndexSnapshot::Section(SnapshotSection section) const
+{
+    if (static_cast<size_t>(section) >= section_count_)
+    {
+        return {};
+    }
+    const SnapshotSectionEntry &entry = sections_[static_cast<size_t>(section)];
+    return std::span<const Type>(reinterpret_cast<const Type *>(static_cast<const char *>(data_) + entry.offset), entry.size / sizeof(Type));
+}
+
+template <typename Type>
+void SnapshotWriter::SetSection(SnapshotSection section, std::span<const Type> values)
+{
+    const char *bytes = reinterpret_cast<const char *>(values.data());
+    sections_[static_cast<size_t>(section)].assign(bytes, bytes + values.size_bytes());
+}
\ No newline at end of file
@@ -0,0 +1,434 @@
+#include <algorithm>
+
+#include "inverted_index.h"
+
+namespace
+{
+    bool PostingLess(const Posting &posting, uint32_t document_ordinal)
+    {
+        return posting.document_ordinal < document_ordinal;
+    }
+
+    // Returns the block that may hold the ordinal or blocks.size() if none.
+    size_t FindBlock(std::span<const PostingBlockHeader> blocks, uint32_t document_ordinal)
+    {
+        auto it = std::lower_bound(blocks.begin(), blocks.end(), document_ordinal, [](const PostingBlockHeader &header, uint32_t ordinal) {
+            return header.last_ordinal < ordinal;
+        });
+        if (it == blocks.end() || it->first_ordinal > document_ordinal)
+        {
+            return blocks.size();
+        }
+        return it - blocks.begin();
+    }
+}
+
+PostingListView::PostingListView(std::span<const PostingBlockHeader> blocks, const uint32_t *block_data, std::span<const Posting> tail, size_t size)
+    : blocks_(blocks), block_data_(block_data), tail_(tail), size_(size)
+{
+}
+
+uint32_t PostingListView::TermCount(uint32_t document_ordinal) const
+{
+    if (!tail_.empty() && tail_.front().document_ordinal <= document_ordinal)
+    {
+        auto it = std::lower_bound(tail_.begin(), tail_.end(), document_ordinal, PostingLess);
+        return it != tail_.end() && it->document_ordinal == document_ordinal ? it->term_count : 0;
+    }
+    const size_t block_index = FindBlock(blocks_, document_ordinal);
+    if (block_index == blocks_.size())
+    {
+        return 0;
+    }
+    uint32_t ordinals[POSTING_BLOCK_SIZE];
+    uint32_t term_counts[POSTING_BLOCK_SIZE];
+    const PostingBlockHeader &header = blocks_[block_index];
+    DecodePostingBlock(header, block_data_, ordinals, term_counts);
+    const uint32_t *it = std::lower_bound(ordinals, ordinals + header.size, document_ordinal);
+    return it != ordinals + header.size && *it == document_ordinal ? term_counts[it - ordinals] : 0;
+}
+
+bool PostingListView::Contains(uint32_t document_ordinal) const
+{
+    return TermCount(document_ordinal) != 0;
+}
+
+size_t PostingListView::Size() const
+{
+    return size_;
+}
+
+bool PostingListView::Empty() const
+{
+    return size_ == 0;
+}
+
+std::span<const PostingBlockHeader> PostingListView::Blocks() const
+{
+    return blocks_;
+}
+
+const uint32_t *PostingListView::BlockData() const
+{
+    return block_data_;
+}
+
+std::span<const Posting> PostingListView::Tail() const
+{
+    return tail_;
+}
+
+PostingList::PostingList(std::pmr::memory_resource *memory_resource)
+    : blocks_(memory_resource), block_data_(memory_resource), tail_(memory_resource)
+{
+}
+
+PostingList::PostingList(const PostingListView &view, std::pmr::memory_resource *memory_resource)
+    : blocks_(view.Blocks().begin(), view.Blocks().end(), memory_resource), block_data_(memory_resource),
+      tail_(view.Tail().begin(), view.Tail().end(), memory_resource), size_(view.Size())
+{
+    for (PostingBlockHeader &header : blocks_)
+    {
+        const uint32_t *words = view.BlockData() + header.data_offset;
+        header.data_offset = block_data_.size();
+        block_data_.insert(block_data_.end(), words, words + PostingBlockWords(header));
+    }
+}
+
+void PostingList::Add(uint32_t document_ordinal, uint32_t term_count)
+{
+    if (!tail_.empty() && tail_.back().document_ordinal == document_ordinal)
+    {
+        tail_.back().term_count += term_count;
+        return;
+    }
+    if (tail_.size() == POSTING_BLOCK_SIZE)
+    {
+        FlushTail();
+    }
+    tail_.push_back({document_ordinal, term_count});
+    ++size_;
+}
+
+PostingListView PostingList::View() const
+{
+    return PostingListView(blocks_, block_data_.data(), tail_, size_);
+}
+
+size_t PostingList::Size() const
+{
+    return size_;
+}
+
+bool PostingList::Empty() const
+{
+    return size_ == 0;
+}
+
+size_t PostingList::MemoryUsage() const
+{
+    return blocks_.capacity() * sizeof(PostingBlockHeader) + block_data_.capacity() * sizeof(uint32_t) + tail_.capacity() * sizeof(Posting);
+}
+
+void PostingList::FlushTail()
+{
+    blocks_.push_back(EncodePostingBlock(tail_.data(), tail_.size(), block_data_));
+    tail_.clear();
+}
+
+PostingCursor::PostingCursor(const PostingListView &postings)
+    : postings_(postings)
+{
+    LoadBlock(0);
+}
+
+size_t PostingCursor::BlockCount() const
+{
+    return postings_.Blocks().size() + (postings_.Tail().empty() ? 0 : 1);
+}
+
+uint32_t PostingCursor::BlockLastOrdinal(size_t block_index) const
+{
+    const std::span<const PostingBlockHeader> blocks = postings_.Blocks();
+    return block_index < blocks.size() ? blocks[block_index].last_ordinal : postings_.Tail().back().document_ordinal;
+}
+
+size_t PostingCursor::FindBlock(uint32_t target) const
+{
+    if (block_index_ < BlockCount() && BlockLastOrdinal(block_index_) >= target)
+    {
+        return block_index_;
+    }
+    const std::span<const PostingBlockHeader> blocks = postings_.Blocks();
+    if (block_index_ < blocks.size())
+    {
+        const auto it = std::partition_point(blocks.begin() + block_index_, blocks.end(), [target](const PostingBlockHeader &header) {
+            return header.last_ordinal < target;
+        });
+        if (it != blocks.end())
+        {
+            return it - blocks.begin();
+        }
+    }
+    const std::span<const Posting> tail = postings_.Tail();
+    return !tail.empty() && tail.back().document_ordinal >= target ? blocks.size() : BlockCount();
+}
+
+void PostingCursor::SkipTo(uint32_t target)
+{
+    if (AtEnd() || Ordinal() >= target)
+    {
+        return;
+    }
+    if (BlockLastOrdinal(block_index_) < target)
+    {
+        LoadBlock(FindBlock(target));
+        if (AtEnd())
+        {
+            return;
+        }
+    }
+    position_ = std::lower_bound(ordinals_ + position_, ordinals_ + block_size_, target) - ordinals_;
+}
+
+void PostingCursor::LoadBlock(size_t block_index)
+{
+    block_index_ = std::min(block_index, BlockCount());
+    position_ = 0;
+    block_size_ = 0;
+    const std::span<const PostingBlockHeader> blocks = postings_.Blocks();
+    if (block_index_ < blocks.size())
+    {
+        DecodePostingBlock(blocks[block_index_], postings_.BlockData(), ordinals_, term_counts_);
+        block_size_ = blocks[block_index_].size;
+    }
+    else if (block_index_ == blocks.size())
+    {
+        for (const Posting &posting : postings_.Tail())
+        {
+            ordinals_[block_size_] = posting.document_ordinal;
+            term_counts_[block_size_] = posting.term_count;
+            ++block_size_;
+        }
+    }
+}
+
+BufferedPostings::BufferedPostings(size_t term_capacity)
+    : term_capacity_(term_capacity), terms_(std::make_unique<Term[]>(term_capacity))
+{
+    size_t slot_count = 1;
+    while (slot_count < term_capacity * 2)
+    {
+        slot_count *= 2;
+    }
+    slot_mask_ = slot_count - 1;
+    slots_ = std::make_unique<std::atomic<uint32_t>[]>(slot_count);
+}
+
+// A term is complete before its slot and the term count publish it.
+uint32_t BufferedPostings::Insert(std::string_view word)
+{
+    const size_t slot = FindSlot(word);
+    const uint32_t occupant = slots_[slot].load(std::memory_order_relaxed);
+    if (occupant != 0)
+    {
+        return occupant - 1;
+    }
+    const uint32_t term_index = term_count_.load(std::memory_order_relaxed);
+    terms_[term_index].word = word;
+    slots_[slot].store(term_index + 1, std::memory_order_release);
+    term_count_.store(term_index + 1, std::memory_order_release);
+    return term_index;
+}
+
+// The array is replaced before the size grows, so a reader that loads the
+// size first finds at least that many postings in the array it loads next.
+void BufferedPostings::Add(uint32_t term_index, uint32_t document_ordinal, uint32_t term_count)
+{
+    Term &term = terms_[term_index];
+    const uint32_t size = term.size.load(std::memory_order_relaxed);
+    Posting *postings = term.postings.load(std::memory_order_relaxed);
+    if (size == term.capacity)
+    {
+        term.capacity = std::max<uint32_t>(term.capacity * 2, 4);
+        Posting *grown = static_cast<Posting *>(arena_.allocate(term.capacity * sizeof(Posting), alignof(Posting)));
+        std::copy_n(postings, size, grown);
+        term.postings.store(grown, std::memory_order_release);
+        postings = grown;
+    }
+    postings[size] = {document_ordinal, term_count};
+    term.size.store(size + 1, std::memory_order_release);
+}
+
+PostingListView BufferedPostings::Find(std::string_view word, uint32_t document_count) const
+{
+    const uint32_t occupant = slots_[FindSlot(word)].load(std::memory_order_acquire);
+    return occupant == 0 ? PostingListView{} : View(occupant - 1, document_count);
+}
+
+bool BufferedPostings::FindTermIndex(std::string_view word, uint32_t &term_index) const
+{
+    const uint32_t occupant = slots_[FindSlot(word)].load(std::memory_order_acquire);
+    if (occupant == 0)
+    {
+        return false;
+    }
+    term_index = occupant - 1;
+    return true;
+}
+
+PostingListView BufferedPostings::View(uint32_t term_index, uint32_t document_count) const
+{
+    const Term &term = terms_[term_index];
+    const uint32_t size = term.size.load(std::memory_order_acquire);
+    const Posting *postings = term.postings.load(std::memory_order_acquire);
+    const size_t visible = std::partition_point(postings, postings + size, [document_count](const Posting &posting) {
+                               return posting.document_ordinal < document_count;
+                           }) -
+                           postings;
+    return PostingListView({}, nullptr, std::span<const Posting>(postings, visible), visible);
+}
+
+std::string_view BufferedPostings::Word(uint32_t term_index) const
+{
+    return terms_[term_index].word;
+}
+
+size_t BufferedPostings::TermCount() const
+{
+    return term_count_.load(std::memory_order_acquire);
+}
+
+size_t BufferedPostings::TermCapacity() const
+{
+    return term_capacity_;
+}
+
+size_t BufferedPostings::FindSlot(std::string_view word) const
+{
+    size_t slot = std::hash<std::string_view>{}(word) & slot_mask_;
+    while (true)
+    {
+        const uint32_t occupant = slots_[slot].load(std::memory_order_acquire);
+        if (occupant == 0 || terms_[occupant - 1].word == word)
+        {
+            return slot;
+        }
+        slot = (slot + 1) & slot_mask_;
+    }
+}
+
+InvertedIndex::InvertedIndex(std::pmr::memory_resource *memory_resource)
+    : memory_resource_(memory_resource), word_to_postings_(memory_resource), inserted_words_(memory_resource)
+{
+}
+
+void InvertedIndex::AttachMapped(std::span<const MappedTerm> terms, const char *words, const PostingBlockHeader *blocks, const uint32_t *block_data)
+{
+    mapped_terms_ = terms;
+    mapped_words_ = words;
+    mapped_blocks_ = blocks;
+    mapped_block_data_ = block_data;
+}
+
+void InvertedIndex::AttachBuffered(const BufferedPostings *postings, uint32_t document_count)
+{
+    buffered_ = postings;
+    buffered_document_count_ = document_count;
+}
+
+IndexedTerm &InvertedIndex::Insert(std::string_view word)
+{
+    auto it = word_to_postings_.find(word);
+    if (it == word_to_postings_.end())
+    {
+        const MappedTerm *term = FindMapped(word);
+        if (term == nullptr)
+        {
+            const uint32_t index = mapped_terms_.size() + inserted_words_.size();
+            inserted_words_.push_back(word);
+            it = word_to_postings_.try_emplace(word, IndexedTerm{index, PostingList(memory_resource_)}).first;
+        }
+        else
+        {
+            it = word_to_postings_.try_emplace(word, IndexedTerm{static_cast<uint32_t>(term - mapped_terms_.data()), PostingList(MappedView(*term), memory_resource_)}).first;
+        }
+    }
+    return it->second;
+}
+
+PostingListView InvertedIndex::Find(std::string_view word) const
+{
+    if (buffered_ != nullptr)
+    {
+        return buffered_->Find(word, buffered_document_count_);
+    }
+    auto it = word_to_postings_.find(word);
+    if (it != word_to_postings_.end())
+    {
+        return it->second.postings.View();
+    }
+    const MappedTerm *term = FindMapped(word);
+    return term == nullptr ? PostingListView{} : MappedView(*term);
+}
+
+bool InvertedIndex::FindTermIndex(std::string_view word, uint32_t &term_index) const
+{
+    if (buffered_ != nullptr)
+    {
+        return buffered_->FindTermIndex(word, term_index);
+    }
+    auto it = word_to_postings_.find(word);
+    if (it != word_to_postings_.end())
+    {
+        term_index = it->second.index;
+        return true;
+    }
+    const MappedTerm *term = FindMapped(word);
+    if (term == nullptr)
+    {
+        return false;
+    }
+    term_index = term - mapped_terms_.data();
+    return true;
+}
+
+const MappedTerm *InvertedIndex::FindMapped(std::string_view word) const
+{
+    auto it = std::lower_bound(mapped_terms_.begin(), mapped_terms_.end(), word, [this](const MappedTerm &term, std::string_view word) {
+        return MappedWord(term) < word;
+    });
+    if (it == mapped_terms_.end() || MappedWord(*it) != word)
+    {
+        return nullptr;
+    }
+    return &*it;
+}
+
+std::string_view InvertedIndex::MappedWord(const MappedTerm &term) const
+{
+    return std::string_view(mapped_words_ + term.word_offset, term.word_size);
+}
+
+std::string_view InvertedIndex::Word(uint32_t term_index) const
+{
+    if (buffered_ != nullptr)
+    {
+        return buffered_->Word(term_index);
+    }
+    return term_index < mapped_terms_.size() ? MappedWord(mapped_terms_[term_index]) : inserted_words_[term_index - mapped_terms_.size()];
+}
+
+size_t InvertedIndex::TermCount() const
+{
+    if (buffered_ != nullptr)
+    {
+        return buffered_->TermCount();
+    }
+    return mapped_terms_.size() + inserted_words_.size();
+}
+
+PostingListView InvertedIndex::MappedView(const MappedTerm &term) const
+{
+    return PostingListView(std::span<const PostingBlockHeader>(mapped_blocks_ + term.first_block, term.block_count), mapped_block_data_, {}, term.posting_count);
+}
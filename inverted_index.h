@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "posting_codec.h"
+#include "thread_pool.h"
+
+// Read-only access to the postings of one term, sorted by document ordinal:
+// compressed blocks followed by an uncompressed tail. The storage belongs
+// to a PostingList or to a mapped snapshot.
+class PostingListView
+{
+public:
+    PostingListView() = default;
+
+    PostingListView(std::span<const PostingBlockHeader> blocks, const uint32_t *block_data, std::span<const Posting> tail, size_t size);
+
+    // Returns 0 if the document does not contain the term.
+    uint32_t TermCount(uint32_t document_ordinal) const;
+
+    bool Contains(uint32_t document_ordinal) const;
+
+    size_t Size() const;
+
+    bool Empty() const;
+
+    std::span<const PostingBlockHeader> Blocks() const;
+
+    const uint32_t *BlockData() const;
+
+    std::span<const Posting> Tail() const;
+
+    // Calls function(document_ordinal, term_count) for every posting.
+    template <typename Function>
+    void ForEach(Function function) const;
+
+    // Blocks are decoded and visited in parallel under a parallel policy
+    // or a PoolExecutionPolicy.
+    template <typename ExecutionPolicy, typename Function>
+    void ForEach(const ExecutionPolicy &execution_policy, Function function) const;
+
+private:
+    std::span<const PostingBlockHeader> blocks_;
+    const uint32_t *block_data_ = nullptr;
+    std::span<const Posting> tail_;
+    size_t size_ = 0;
+
+    template <typename Function>
+    void ForEachInBlock(size_t block_index, Function &function) const;
+};
+
+// Moves forward over the postings of a view one block at a time. Blocks
+// are indexed in storage order, the tail counting as the last one; blocks
+// passed over by SkipTo are not decoded.
+class PostingCursor
+{
+public:
+    explicit PostingCursor(const PostingListView &postings);
+
+    bool AtEnd() const
+    {
+        return block_size_ == 0;
+    }
+
+    // The current posting; undefined at the end.
+    uint32_t Ordinal() const
+    {
+        return ordinals_[position_];
+    }
+
+    uint32_t TermCount() const
+    {
+        return term_counts_[position_];
+    }
+
+    size_t BlockIndex() const
+    {
+        return block_index_;
+    }
+
+    size_t BlockCount() const;
+
+    uint32_t BlockLastOrdinal(size_t block_index) const;
+
+    // Index of the block holding the first posting with an ordinal of at
+    // least target, searching from the current block; BlockCount() if there
+    // is none. The cursor does not move.
+    size_t FindBlock(uint32_t target) const;
+
+    void Next()
+    {
+        if (++position_ == block_size_)
+        {
+            LoadBlock(block_index_ + 1);
+        }
+    }
+
+    // Moves to the first posting with an ordinal of at least target.
+    void SkipTo(uint32_t target);
+
+private:
+    PostingListView postings_;
+    size_t block_index_ = 0;
+    size_t position_ = 0;
+    size_t block_size_ = 0;
+    uint32_t ordinals_[POSTING_BLOCK_SIZE];
+    uint32_t term_counts_[POSTING_BLOCK_SIZE];
+
+    void LoadBlock(size_t block_index);
+};
+
+// Postings of one term. Full blocks of POSTING_BLOCK_SIZE postings are
+// stored compressed, the newest postings stay in an uncompressed tail until
+// it fills up. Ordinals must be added in non-decreasing order.
+class PostingList
+{
+public:
+    explicit PostingList(std::pmr::memory_resource *memory_resource = std::pmr::get_default_resource());
+
+    // Copies the postings of a view, e.g. one backed by a mapped snapshot.
+    PostingList(const PostingListView &view, std::pmr::memory_resource *memory_resource = std::pmr::get_default_resource());
+
+    // Counts term_count more occurrences of the term in the document.
+    void Add(uint32_t document_ordinal, uint32_t term_count = 1);
+
+    PostingListView View() const;
+
+    size_t Size() const;
+
+    bool Empty() const;
+
+    size_t MemoryUsage() const;
+
+private:
+    std::pmr::vector<PostingBlockHeader> blocks_;
+    std::pmr::vector<uint32_t> block_data_;
+    std::pmr::vector<Posting> tail_;
+    size_t size_ = 0;
+
+    void FlushTail();
+};
+
+// Term of a mapped snapshot dictionary; the array is sorted by word.
+struct MappedTerm
+{
+    uint64_t word_offset;
+    uint32_t word_size;
+    uint32_t posting_count;
+    uint64_t first_block;
+    uint64_t block_count;
+};
+
+// Posting list of a word and the index that numbers the word in its
+// dictionary.
+struct IndexedTerm
+{
+    uint32_t index;
+    PostingList postings;
+};
+
+// Postings of the documents of a write buffer. One writer appends terms
+// and postings in place while queries read them; a reader passes the
+// number of documents its version covers and sees the postings of those
+// only. Postings are added in ascending ordinal order, and a list must not
+// grow past POSTING_BLOCK_SIZE, as it is viewed as an uncompressed tail.
+class BufferedPostings
+{
+public:
+    // Takes up to term_capacity distinct words.
+    explicit BufferedPostings(size_t term_capacity);
+
+    BufferedPostings(const BufferedPostings &) = delete;
+
+    BufferedPostings &operator=(const BufferedPostings &) = delete;
+
+    // Returns the index of word, adding it if needed. The word is stored by
+    // reference.
+    uint32_t Insert(std::string_view word);
+
+    // Counts term_count occurrences of the term in a new document.
+    void Add(uint32_t term_index, uint32_t document_ordinal, uint32_t term_count);
+
+    // Returns an empty view if the word is not indexed.
+    PostingListView Find(std::string_view word, uint32_t document_count) const;
+
+    // Sets term_index to the index of word; false if it is not indexed.
+    bool FindTermIndex(std::string_view word, uint32_t &term_index) const;
+
+    PostingListView View(uint32_t term_index, uint32_t document_count) const;
+
+    std::string_view Word(uint32_t term_index) const;
+
+    size_t TermCount() const;
+
+    size_t TermCapacity() const;
+
+private:
+    // Postings of a term are copied to an array twice the size when theirs
+    // is full. Outgrown arrays stay in the arena, as readers may still be
+    // walking them.
+    struct Term
+    {
+        std::string_view word;
+        std::atomic<Posting *> postings = nullptr;
+        std::atomic<uint32_t> size = 0;
+        uint32_t capacity = 0;
+    };
+
+    std::pmr::monotonic_buffer_resource arena_;
+    size_t term_capacity_;
+    std::unique_ptr<Term[]> terms_;
+    std::atomic<uint32_t> term_count_ = 0;
+    // Open addressing on the hash of the word; a slot holds the index of
+    // its term plus one, 0 while free. Never more than half full.
+    size_t slot_mask_;
+    std::unique_ptr<std::atomic<uint32_t>[]> slots_;
+
+    // The slot of word, or the free slot it would take.
+    size_t FindSlot(std::string_view word) const;
+};
+
+// Term dictionary: hash table from a word to its posting list. It can sit
+// on top of a read-only mapped dictionary; a mapped term is copied into the
+// hash table the first time it is modified. Words are not copied: they are
+// interned by the server and outlive every index. The hash table and the
+// posting lists allocate from the given memory resource. Terms are numbered
+// densely: mapped terms by their position in the mapped dictionary, the
+// others after them in order of insertion. An index attached to a write
+// buffer serves its postings instead and is never modified.
+class InvertedIndex
+{
+public:
+    using Dictionary = std::pmr::unordered_map<std::string_view, IndexedTerm>;
+
+    explicit InvertedIndex(std::pmr::memory_resource *memory_resource = std::pmr::get_default_resource());
+
+    void AttachMapped(std::span<const MappedTerm> terms, const char *words, const PostingBlockHeader *blocks, const uint32_t *block_data);
+
+    // Serves the postings of the first document_count documents of a write
+    // buffer, numbering terms as the buffer does.
+    void AttachBuffered(const BufferedPostings *postings, uint32_t document_count);
+
+    // Returns the term of word, creating an empty one if needed. The word is
+    // stored by reference.
+    IndexedTerm &Insert(std::string_view word);
+
+    // Returns an empty view if the word is not indexed.
+    PostingListView Find(std::string_view word) const;
+
+    // Sets term_index to the index of word; false if it is not indexed.
+    bool FindTermIndex(std::string_view word, uint32_t &term_index) const;
+
+    // Calls function(word, view) for every word with postings.
+    template <typename Function>
+    void ForEachTerm(Function function) const;
+
+    // Calls function(term_index, word, view) for every word with postings.
+    template <typename Function>
+    void ForEachIndexedTerm(Function function) const;
+
+    std::string_view Word(uint32_t term_index) const;
+
+    // Number of terms, including mapped ones and those without postings.
+    size_t TermCount() const;
+
+private:
+    std::pmr::memory_resource *memory_resource_;
+    Dictionary word_to_postings_;
+    std::pmr::vector<std::string_view> inserted_words_;
+    std::span<const MappedTerm> mapped_terms_;
+    const char *mapped_words_ = nullptr;
+    const PostingBlockHeader *mapped_blocks_ = nullptr;
+    const uint32_t *mapped_block_data_ = nullptr;
+    const BufferedPostings *buffered_ = nullptr;
+    uint32_t buffered_document_count_ = 0;
+
+    const MappedTerm *FindMapped(std::string_view word) const;
+
+    std::string_view MappedWord(const MappedTerm &term) const;
+
+    PostingListView MappedView(const MappedTerm &term) const;
+};
+
+template <typename Function>
+void PostingListView::ForEach(Function function) const
+{
+    for (size_t block_index = 0; block_index <= blocks_.size(); ++block_index)
+    {
+        ForEachInBlock(block_index, function);
+    }
+}
+
+template <typename ExecutionPolicy, typename Function>
+void PostingListView::ForEach(const ExecutionPolicy &execution_policy, Function function) const
+{
+    if constexpr (std::is_same_v<ExecutionPolicy, std::execution::sequenced_policy>)
+    {
+        ForEach(function);
+    }
+    else
+    {
+        ParallelFor(execution_policy, blocks_.size() + 1, [&](size_t block_index) {
+            ForEachInBlock(block_index, function);
+        });
+    }
+}
+
+// The block index one past the last compressed block stands for the tail.
+template <typename Function>
+void PostingListView::ForEachInBlock(size_t block_index, Function &function) const
+{
+    if (block_index == blocks_.size())
+    {
+        for (const Posting &posting : tail_)
+        {
+            function(posting.document_ordinal, posting.term_count);
+        }
+        return;
+    }
+    uint32_t ordinals[POSTING_BLOCK_SIZE];
+    uint32_t term_counts[POSTING_BLOCK_SIZE];
+    const PostingBlockHeader &header = blocks_[block_index];
+    DecodePostingBlock(header, block_data_, ordinals, term_counts);
+    for (size_t i = 0; i < header.size; ++i)
+    {
+        function(ordinals[i], term_counts[i]);
+    }
+}
+
+template <typename Function>
+void InvertedIndex::ForEachTerm(Function function) const
+{
+    ForEachIndexedTerm([&function](uint32_t, std::string_view word, const PostingListView &view) {
+        function(word, view);
+    });
+}
+
+template <typename Function>
+void InvertedIndex::ForEachIndexedTerm(Function function) const
+{
+    if (buffered_ != nullptr)
+    {
+        for (uint32_t term_index = 0; term_index < buffered_->TermCount(); ++term_index)
+        {
+            const PostingListView view = buffered_->View(term_index, buffered_document_count_);
+            if (!view.Empty())
+            {
+                function(term_index, buffered_->Word(term_index), view);
+            }
+        }
+        return;
+    }
+    for (const auto &[word, term] : word_to_postings_)
+    {
+        if (!term.postings.Empty())
+        {
+            function(term.index, word, term.postings.View());
+        }
+    }
+    for (size_t term_index = 0; term_index < mapped_terms_.size(); ++term_index)
+    {
+        const std::string_view word = MappedWord(mapped_terms_[term_index]);
+        if (word_to_postings_.count(word) == 0)
+        {
+            function(term_index, word, MappedView(mapped_terms_[term_index]));
+        }
+    }
+}
\ No newline at end of file
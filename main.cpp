@@ -1,66 +1,117 @@
 #include "search_server.h"
 
+#include "benchmark_data.h"
 #include "log_duration.h"
+#include "posting_codec.h"
+#include "process_queries.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "sharded_search_server.h"
+#include "thread_pool.h"
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <execution>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <random>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
 
-string GenerateWord(mt19937 &generator, int max_length)
+size_t GetResidentMemoryKb()
 {
-    const int length = uniform_int_distribution(1, max_length)(generator);
-    string word;
-    word.reserve(length);
-    for (int i = 0; i < length; ++i)
+    ifstream status("/proc/self/status"s);
+    for (string line; getline(status, line);)
     {
-        word.push_back(uniform_int_distribution('a', 'z')(generator));
+        if (line.rfind("VmRSS:"s, 0) == 0)
+        {
+            return stoul(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+// Number of checks that found mismatches; main fails unless it is 0.
+int failed_check_count = 0;
+
+void Check(string_view name, int mismatch_count)
+{
+    cout << name << ": "s << mismatch_count << " mismatches"s << endl;
+    failed_check_count += mismatch_count != 0;
+}
+
+// What the documents of two results must share. Relevances always agree
+// within tolerance; ids are compared only where documents of equal
+// relevance keep their order.
+struct DocumentComparison
+{
+    double tolerance = RELEVANCE_TOLERANCE;
+    bool ids = false;
+    bool ratings = false;
+};
+
+bool EqualDocuments(const vector<Document> &found, const vector<Document> &expected, DocumentComparison comparison = {})
+{
+    return found.size() == expected.size() && equal(found.begin(), found.end(), expected.begin(), [&comparison](const Document &lhs, const Document &rhs) {
+               return abs(lhs.relevance - rhs.relevance) <= comparison.tolerance && (!comparison.ids || lhs.id == rhs.id)
+                      && (!comparison.ratings || lhs.rating == rhs.rating);
+           });
+}
+
+// Number of queries whose results differ.
+int CountMismatches(const vector<vector<Document>> &found, const vector<vector<Document>> &expected, DocumentComparison comparison = {})
+{
+    int mismatch_count = abs(static_cast<int>(found.size()) - static_cast<int>(expected.size()));
+    for (size_t i = 0; i < min(found.size(), expected.size()); ++i)
+    {
+        mismatch_count += !EqualDocuments(found[i], expected[i], comparison);
     }
-    return word;
+    return mismatch_count;
 }
 
-vector<string> GenerateDictionary(mt19937 &generator, int word_count, int max_length)
+// The results the checks compare against: FindTopDocuments of every query,
+// run sequentially.
+vector<vector<Document>> FindTopDocumentsOfEach(const SearchServer &search_server, const vector<string> &queries)
 {
-    vector<string> words;
-    words.reserve(word_count);
-    for (int i = 0; i < word_count; ++i)
+    vector<vector<Document>> results;
+    results.reserve(queries.size());
+    for (const string &query : queries)
     {
-        words.push_back(GenerateWord(generator, max_length));
+        results.push_back(search_server.FindTopDocuments(execution::seq, query));
     }
-    words.erase(unique(words.begin(), words.end()), words.end());
-    return words;
+    return results;
 }
 
-string GenerateQuery(mt19937 &generator, const vector<string> &dictionary, int word_count, double minus_prob = 0)
+// The first document_count documents with their index as id, ACTUAL and
+// rated {1, 2, 3}, or by id % 7 if rated_by_id, so that ratings tell
+// documents apart.
+vector<DocumentInput> MakeBatch(const vector<string> &documents, size_t document_count, bool rated_by_id = false)
 {
-    string query;
-    for (int i = 0; i < word_count; ++i)
+    vector<DocumentInput> batch;
+    batch.reserve(document_count);
+    for (size_t i = 0; i < document_count; ++i)
     {
-        if (!query.empty())
-        {
-            query.push_back(' ');
-        }
-        if (uniform_real_distribution<>(0, 1)(generator) < minus_prob)
-        {
-            query.push_back('-');
-        }
-        query += dictionary[uniform_int_distribution<int>(0, dictionary.size() - 1)(generator)];
+        batch.push_back({static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, rated_by_id ? vector<int>{static_cast<int>(i % 7)} : vector<int>{1, 2, 3}});
     }
-    return query;
+    return batch;
 }
 
-vector<string> GenerateQueries(mt19937 &generator, const vector<string> &dictionary, int query_count, int max_word_count)
+// Adds the documents with ids in [first, last) one at a time, like the
+// documents of MakeBatch.
+void AddEach(SearchServer &search_server, const vector<string> &documents, size_t first, size_t last)
 {
-    vector<string> queries;
-    queries.reserve(query_count);
-    for (int i = 0; i < query_count; ++i)
+    for (size_t i = first; i < last; ++i)
     {
-        queries.push_back(GenerateQuery(generator, dictionary, max_word_count));
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
     }
-    return queries;
 }
 
 template <typename ExecutionPolicy>
@@ -81,6 +132,937 @@ void Test(string_view mark, const SearchServer &search_server, const vector<stri
 
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 
+// Pruned top-K search against the exhaustive FindTopDocuments, on the given
+// queries and on the same queries with some minus words.
+void TestPruned(const SearchServer &search_server, const vector<string> &queries, const vector<string> &dictionary)
+{
+    // The first query computes the block maxima of the segments.
+    search_server.FindTopDocumentsPruned(queries.front());
+    {
+        LOG_DURATION("pruned"s, std::cerr);
+        double total_relevance = 0;
+        for (const string_view query : queries)
+        {
+            for (const auto &document : search_server.FindTopDocumentsPruned(query))
+            {
+                total_relevance += document.relevance;
+            }
+        }
+        cout << total_relevance << endl;
+    }
+
+    mt19937 generator;
+    vector<string> checked_queries = queries;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        checked_queries.push_back(GenerateQuery(generator, dictionary, 70, 0.1));
+    }
+    vector<vector<Document>> found;
+    for (const string &query : checked_queries)
+    {
+        found.push_back(search_server.FindTopDocumentsPruned(query));
+    }
+    Check("pruned"s, CountMismatches(found, FindTopDocumentsOfEach(search_server, checked_queries), {.ratings = true}));
+}
+
+// Pruning on text and queries whose words follow Zipf's law: the common
+// words of a query are in most documents and weigh little, so their
+// blocks are skipped once the top documents are found among the rare ones.
+void TestSkewedPruning(const vector<string> &dictionary)
+{
+    mt19937 generator;
+    const vector<string> documents = GenerateZipfQueries(generator, dictionary, 100'000, 20);
+    const vector<string> queries = GenerateZipfQueries(generator, dictionary, 200, 5);
+    SearchServer search_server(""s);
+    search_server.AddDocuments(execution::seq, MakeBatch(documents, documents.size(), true));
+    search_server.FindTopDocumentsPruned(queries.front());
+
+    vector<vector<Document>> exhaustive;
+    {
+        LOG_DURATION("skewed exhaustive"s, std::cerr);
+        for (const string &query : queries)
+        {
+            exhaustive.push_back(search_server.FindTopDocuments<TfIdfRanking>(execution::seq, query));
+        }
+    }
+    vector<vector<Document>> pruned;
+    {
+        LOG_DURATION("skewed pruned"s, std::cerr);
+        for (const string &query : queries)
+        {
+            pruned.push_back(search_server.FindTopDocumentsPruned(query));
+        }
+    }
+    Check("skewed pruned"s, CountMismatches(pruned, exhaustive, {.ratings = true}));
+}
+
+// MatchDocument spends most of its time tokenizing and parsing the query;
+// the Allocations program counts the heap allocations it makes.
+void TestQueryParsing(const SearchServer &search_server, const vector<string> &queries)
+{
+    LOG_DURATION("match documents"s, std::cerr);
+    size_t matched_word_count = 0;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        matched_word_count += get<0>(search_server.MatchDocument(queries[i], i % search_server.GetDocumentCount())).size();
+    }
+    cout << matched_word_count << endl;
+}
+
+template <typename ExecutionPolicy>
+void TestRemoval(string_view mark, const vector<string> &documents, ExecutionPolicy &&policy)
+{
+    SearchServer search_server("and with"s);
+    AddEach(search_server, documents, 0, documents.size());
+    string str{mark};
+    LOG_DURATION(str, std::cerr);
+    for (size_t i = 0; i < documents.size(); i += 2)
+    {
+        search_server.RemoveDocument(policy, i);
+    }
+    cout << search_server.GetDocumentCount() << endl;
+}
+
+#define TEST_REMOVAL(policy) TestRemoval("remove "s + #policy, removal_documents, execution::policy)
+
+void TestIngestLoop(string_view mark, const vector<string> &documents, bool with_positions)
+{
+    SearchServer search_server("and with"s);
+    if (with_positions)
+    {
+        search_server.EnablePositions();
+    }
+    string str{mark};
+    LOG_DURATION(str, std::cerr);
+    AddEach(search_server, documents, 0, documents.size());
+}
+
+template <typename ExecutionPolicy>
+void TestIngest(string_view mark, const vector<string> &documents, ExecutionPolicy &&policy)
+{
+    const vector<DocumentInput> batch = MakeBatch(documents, documents.size());
+    SearchServer search_server("and with"s);
+    string str{mark};
+    LOG_DURATION(str, std::cerr);
+    search_server.AddDocuments(policy, batch);
+}
+
+#define TEST_INGEST(policy) TestIngest("ingest batch "s + #policy, removal_documents, execution::policy)
+
+// Readers query while a writer adds documents and removes every third one.
+// Afterwards the server must answer like one built from the survivors.
+void TestConcurrentUpdates(const vector<string> &documents, const vector<string> &queries)
+{
+    const int reader_count = 3;
+    SearchServer search_server("and with"s);
+    atomic_bool writing = true;
+    atomic_size_t query_count = 0;
+    {
+        LOG_DURATION("concurrent updates"s, std::cerr);
+        vector<thread> readers;
+        for (int i = 0; i < reader_count; ++i)
+        {
+            readers.emplace_back([&]() {
+                for (size_t j = 0; writing; ++j)
+                {
+                    search_server.FindTopDocuments(execution::par, queries[j % queries.size()]);
+                    ++query_count;
+                }
+            });
+        }
+        for (size_t i = 0; i < documents.size(); ++i)
+        {
+            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+            if (i % 3 == 2)
+            {
+                search_server.RemoveDocument(i - 1);
+            }
+        }
+        writing = false;
+        for (thread &reader : readers)
+        {
+            reader.join();
+        }
+    }
+
+    SearchServer expected_server("and with"s);
+    for (const int document_id : search_server)
+    {
+        expected_server.AddDocument(document_id, documents[document_id], DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    cout << query_count << " queries during updates"s << endl;
+    Check("updates"s, CountMismatches(FindTopDocumentsOfEach(search_server, queries), FindTopDocumentsOfEach(expected_server, queries)));
+}
+
+// Query latency percentiles while a writer thread keeps adding documents.
+void TestQueryLatencyUnderIngest(const vector<string> &documents, const vector<string> &queries)
+{
+    SearchServer search_server("and with"s);
+    AddEach(search_server, documents, 0, documents.size() / 2);
+    atomic_bool writing = true;
+    thread writer([&]() {
+        AddEach(search_server, documents, documents.size() / 2, documents.size());
+        writing = false;
+    });
+    vector<int64_t> latencies;
+    for (size_t j = 0; writing; ++j)
+    {
+        const auto start_time = chrono::steady_clock::now();
+        search_server.FindTopDocuments(queries[j % queries.size()]);
+        latencies.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start_time).count());
+    }
+    writer.join();
+    if (latencies.empty())
+    {
+        return;
+    }
+    sort(latencies.begin(), latencies.end());
+    cerr << "query latency under ingest: p50 "s << latencies[latencies.size() / 2] << " us, p99 "s
+         << latencies[latencies.size() * 99 / 100] << " us over "s << latencies.size() << " queries"s << endl;
+}
+
+// Every third document repeats the words of the previous one in reverse
+// order, so exactly those must be removed.
+void TestRemoveDuplicates(const vector<string> &documents)
+{
+    SearchServer search_server("and with"s);
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        string document = documents[i];
+        if (i % 3 == 2)
+        {
+            const vector<string_view> words = SplitIntoWordsView(documents[i - 1]);
+            document.clear();
+            for (auto it = words.rbegin(); it != words.rend(); ++it)
+            {
+                document += string(*it) + " "s;
+            }
+        }
+        search_server.AddDocument(i, document, DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    vector<int> removed;
+    {
+        LOG_DURATION("remove duplicates"s, std::cerr);
+        removed = RemoveDuplicates(search_server);
+    }
+    cout << removed.size() << " duplicates removed"s << endl;
+    Check("duplicates"s, count_if(removed.begin(), removed.end(), [](int document_id) {
+              return document_id % 3 != 2;
+          }));
+    {
+        LOG_DURATION("remove near duplicates"s, std::cerr);
+        removed = RemoveNearDuplicates(search_server, 0.9);
+    }
+    cout << removed.size() << " near duplicates removed"s << endl;
+}
+
+// The batch must answer like the queries run one by one, up to the order
+// of documents with equal relevance and rating.
+void TestProcessQueries(const SearchServer &search_server, const vector<string> &queries)
+{
+    vector<vector<Document>> expected(queries.size());
+    {
+        LOG_DURATION("queries one by one"s, std::cerr);
+        transform(execution::par, queries.begin(), queries.end(), expected.begin(), [&search_server](const string &query) {
+            return search_server.FindTopDocuments(query);
+        });
+    }
+    vector<vector<Document>> found;
+    {
+        LOG_DURATION("queries in batch"s, std::cerr);
+        found = ProcessQueries(search_server, queries);
+    }
+    Check("batch"s, CountMismatches(found, expected));
+    cout << ProcessQueriesJoined(search_server, queries).size() << " joined documents"s << endl;
+}
+
+// The lazy joined range must yield the documents of ProcessQueriesJoined
+// in the same order; its first document should arrive long before the
+// whole batch is done.
+void TestProcessQueriesLazy(const SearchServer &search_server, const vector<string> &queries)
+{
+    vector<Document> expected;
+    {
+        LOG_DURATION("joined queries"s, std::cerr);
+        expected = ProcessQueriesJoined(search_server, queries);
+    }
+    const auto start_time = chrono::steady_clock::now();
+    JoinedQueryResults results = ProcessQueriesJoinedLazy(search_server, queries);
+    auto it = results.begin();
+    const auto first_result_time = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start_time);
+    vector<Document> found;
+    for (; it != results.end(); ++it)
+    {
+        found.push_back(*it);
+    }
+    const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time);
+    cerr << "lazy joined queries: first result "s << first_result_time.count() << " us, all "s << duration.count() << " ms"s << endl;
+    cout << found.size() << " lazily joined documents"s << endl;
+    Check("lazy batch"s, !EqualDocuments(found, expected));
+}
+
+// Repeated requests are answered from the cache until a document is added,
+// after which the same answers as without the cache must come back.
+void TestResultCache(const vector<string> &documents, const vector<string> &queries)
+{
+    SearchServer search_server("and with"s);
+    SearchServer uncached_server("and with"s);
+    AddEach(search_server, documents, 0, documents.size() - 1);
+    AddEach(uncached_server, documents, 0, documents.size() - 1);
+    search_server.EnableResultCache(1'000);
+    RequestQueue request_queue(search_server);
+    {
+        LOG_DURATION("cached requests"s, std::cerr);
+        for (int round = 0; round < 10; ++round)
+        {
+            for (const string &query : queries)
+            {
+                request_queue.AddFindRequest(query);
+            }
+        }
+    }
+    AddEach(search_server, documents, documents.size() - 1, documents.size());
+    AddEach(uncached_server, documents, documents.size() - 1, documents.size());
+    vector<vector<Document>> found;
+    for (const string &query : queries)
+    {
+        found.push_back(search_server.FindTopDocuments(query));
+    }
+    const ResultCacheStats stats = search_server.GetResultCacheStats();
+    cout << stats.hits << " hits, "s << stats.misses << " misses, "s << stats.evictions << " evictions, "s << stats.invalidations << " invalidations"s << endl;
+    Check("result cache"s, CountMismatches(found, FindTopDocumentsOfEach(uncached_server, queries)));
+}
+
+// Parsing and scoring of short queries, where looking up the words costs
+// as much as walking their postings. Half of the documents are removed
+// first, so most segments hold removed postings.
+void TestShortQueries(const vector<string> &documents, const vector<string> &dictionary)
+{
+    SearchServer search_server("and with"s);
+    AddEach(search_server, documents, 0, documents.size());
+    for (size_t i = 0; i < documents.size(); i += 2)
+    {
+        search_server.RemoveDocument(i);
+    }
+    mt19937 generator;
+    vector<string> queries;
+    for (int i = 0; i < 10'000; ++i)
+    {
+        queries.push_back(GenerateQuery(generator, dictionary, uniform_int_distribution(3, 5)(generator), 0.2));
+    }
+    Test("short queries"s, search_server, queries, execution::seq);
+}
+
+// Builds the index document by document, on the heap or in arenas, and
+// reports build time, resident memory and query time.
+void TestArenaBuild(string_view mark, SearchServer &search_server, const vector<string> &documents, const vector<string> &queries)
+{
+    const size_t memory_before_index = GetResidentMemoryKb();
+    {
+        LOG_DURATION("build "s + string(mark), std::cerr);
+        AddEach(search_server, documents, 0, documents.size());
+    }
+    cerr << "memory "s << mark << ": "s << GetResidentMemoryKb() - memory_before_index << " kB"s << endl;
+    Test("queries "s + string(mark), search_server, queries, execution::seq);
+}
+
+void TestArenas(const vector<string> &documents, const vector<string> &queries)
+{
+    SearchServer heap_server("and with"s);
+    TestArenaBuild("heap"s, heap_server, documents, queries);
+    SearchServer arena_server("and with"s);
+    arena_server.EnableArenas();
+    TestArenaBuild("arenas"s, arena_server, documents, queries);
+    Check("arenas"s, CountMismatches(FindTopDocumentsOfEach(arena_server, queries), FindTopDocumentsOfEach(heap_server, queries), {.ids = true}));
+}
+
+// Scatter-gather queries over shards against one server with the same
+// documents; relevances must be equal, not merely close.
+void TestShardedServer(const vector<string> &documents, const vector<string> &queries)
+{
+    const vector<DocumentInput> batch = MakeBatch(documents, documents.size(), true);
+    SearchServer search_server("and with"s);
+    search_server.AddDocuments(execution::par, batch);
+    ShardedSearchServer sharded_server("and with"s);
+    {
+        LOG_DURATION("sharded ingest"s, std::cerr);
+        sharded_server.AddDocuments(batch);
+    }
+    Test("unsharded queries"s, search_server, queries, execution::seq);
+    vector<vector<Document>> sharded_results;
+    {
+        LOG_DURATION("sharded queries"s, std::cerr);
+        for (const string &query : queries)
+        {
+            sharded_results.push_back(sharded_server.FindTopDocuments(query));
+        }
+    }
+    Check(to_string(sharded_server.ShardCount()) + " shards"s,
+          CountMismatches(sharded_results, FindTopDocumentsOfEach(search_server, queries), {.tolerance = 0, .ratings = true}));
+
+    // A batch with one rejected document leaves every shard unchanged.
+    int mismatch_count = 0;
+    const int document_count = sharded_server.GetDocumentCount();
+    for (const DocumentInput &rejected : {batch.front(), DocumentInput{-1, "cat"sv, DocumentStatus::ACTUAL, {}}, DocumentInput{static_cast<int>(documents.size()) + 1, "c\x01t"sv, DocumentStatus::ACTUAL, {}}})
+    {
+        try
+        {
+            sharded_server.AddDocuments({{static_cast<int>(documents.size()), "cat"sv, DocumentStatus::ACTUAL, {1}}, rejected});
+            ++mismatch_count;
+        }
+        catch (const invalid_argument &)
+        {
+        }
+        mismatch_count += sharded_server.GetDocumentCount() != document_count;
+    }
+    Check("rejected sharded batches"s, mismatch_count);
+}
+
+// Counts the phrase queries whose matches differ from those found by
+// scanning the documents with ids in [0, document_count) not divisible by
+// removed_step.
+int CountPhraseMismatches(const SearchServer &search_server, const vector<vector<string_view>> &document_words, size_t document_count, size_t removed_step,
+                          const vector<pair<string_view, string_view>> &phrases)
+{
+    int mismatch_count = 0;
+    for (const auto &[first_word, second_word] : phrases)
+    {
+        set<int> expected;
+        for (size_t id = 0; id < document_count; ++id)
+        {
+            const vector<string_view> &words = document_words[id];
+            for (size_t j = 0; id % removed_step != 0 && j + 1 < words.size(); ++j)
+            {
+                if (words[j] == first_word && words[j + 1] == second_word)
+                {
+                    expected.insert(id);
+                    break;
+                }
+            }
+        }
+        const string phrase_query = "\""s + string(first_word) + " "s + string(second_word) + "\""s;
+        set<int> found;
+        for (const Document &document : search_server.FindTopDocuments(phrase_query, DocumentStatus::ACTUAL, document_count))
+        {
+            found.insert(document.id);
+        }
+        mismatch_count += found != expected;
+    }
+    return mismatch_count;
+}
+
+// Phrases across stop words match only where a stop word sits between
+// their words, and phrases need positions.
+int CountStopWordPhraseMismatches()
+{
+    SearchServer search_server("and with"s);
+    search_server.EnablePositions();
+    search_server.AddDocument(0, "cat dog"sv, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(1, "cat and dog"sv, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "cat with dog"sv, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(3, "cat and the dog"sv, DocumentStatus::ACTUAL, {1});
+    const auto found_ids = [&search_server](string_view query) {
+        set<int> ids;
+        for (const Document &document : search_server.FindTopDocuments(query))
+        {
+            ids.insert(document.id);
+        }
+        return ids;
+    };
+    int mismatch_count = found_ids("\"cat dog\""sv) != set<int>{0};
+    mismatch_count += found_ids("\"cat and dog\""sv) != set<int>{1, 2};
+    mismatch_count += found_ids("\"and cat with\" dog"sv) != set<int>{0, 1, 2, 3};
+
+    SearchServer server_without_positions("and with"s);
+    server_without_positions.AddDocument(0, "cat dog"sv, DocumentStatus::ACTUAL, {1});
+    try
+    {
+        server_without_positions.FindTopDocuments("\"cat dog\""sv);
+        ++mismatch_count;
+    }
+    catch (const invalid_argument &)
+    {
+    }
+    return mismatch_count;
+}
+
+// Queries with a two-word phrase taken from a document and two more words,
+// against the same words without quotes. Phrase matches are also checked
+// on a server built document by document, whose segments get merged, and
+// on its snapshot.
+void TestPhraseQueries(const vector<string> &documents)
+{
+    SearchServer search_server("and with"s);
+    search_server.EnablePositions();
+    search_server.AddDocuments(execution::par, MakeBatch(documents, documents.size()));
+    vector<vector<string_view>> document_words;
+    for (const string &document : documents)
+    {
+        document_words.push_back(SplitIntoWordsView(document));
+    }
+    mt19937 generator;
+    vector<string> phrase_queries;
+    vector<string> word_queries;
+    vector<pair<string_view, string_view>> phrases;
+    for (int i = 0; i < 1'000; ++i)
+    {
+        const vector<string_view> &words = document_words[uniform_int_distribution<size_t>(0, documents.size() - 1)(generator)];
+        const size_t first = uniform_int_distribution<size_t>(0, words.size() - 2)(generator);
+        const vector<string_view> &other_words = document_words[uniform_int_distribution<size_t>(0, documents.size() - 1)(generator)];
+        const string extra_words = string(other_words[0]) + " "s + string(other_words[1]);
+        phrases.emplace_back(words[first], words[first + 1]);
+        phrase_queries.push_back("\""s + string(words[first]) + " "s + string(words[first + 1]) + "\" "s + extra_words);
+        word_queries.push_back(string(words[first]) + " "s + string(words[first + 1]) + " "s + extra_words);
+    }
+    Test("phrase queries cold"s, search_server, phrase_queries, execution::seq);
+    Test("phrase queries"s, search_server, phrase_queries, execution::seq);
+    Test("bag of words queries"s, search_server, word_queries, execution::seq);
+    {
+        LOG_DURATION("proximity queries"s, std::cerr);
+        double total_relevance = 0;
+        for (const string &query : word_queries)
+        {
+            for (const Document &document : search_server.FindTopDocumentsByProximity(query))
+            {
+                total_relevance += document.relevance;
+            }
+        }
+        cout << total_relevance << endl;
+    }
+    const vector<pair<string_view, string_view>> checked_phrases(phrases.begin(), phrases.begin() + 50);
+    int mismatch_count = CountPhraseMismatches(search_server, document_words, documents.size(), documents.size() + 1, checked_phrases);
+
+    const size_t merged_document_count = 10'000;
+    const size_t removed_step = 3;
+    SearchServer merged_server("and with"s);
+    merged_server.EnablePositions();
+    AddEach(merged_server, documents, 0, merged_document_count);
+    for (size_t i = 0; i < merged_document_count; i += removed_step)
+    {
+        merged_server.RemoveDocument(i);
+    }
+    mismatch_count += CountPhraseMismatches(merged_server, document_words, merged_document_count, removed_step, checked_phrases);
+    merged_server.SaveSnapshot("phrases.snapshot"s);
+    const SearchServer loaded_server = SearchServer::LoadSnapshot("phrases.snapshot"s);
+    mismatch_count += CountPhraseMismatches(loaded_server, document_words, merged_document_count, removed_step, checked_phrases);
+    remove("phrases.snapshot");
+    mismatch_count += CountStopWordPhraseMismatches();
+    Check("phrases"s, mismatch_count);
+}
+
+// BM25 scores of FindTopDocuments against a direct computation over the
+// live documents, with the average length kept up to date through batch
+// and single additions and removals.
+void TestRanking(const vector<string> &documents, const vector<string> &queries)
+{
+    const size_t batch_size = documents.size() * 2 / 3;
+    const size_t removed_step = 4;
+    const vector<DocumentInput> batch = MakeBatch(documents, batch_size, true);
+    SearchServer search_server("and with"s);
+    ShardedSearchServer sharded_server("and with"s);
+    search_server.AddDocuments(execution::par, batch);
+    sharded_server.AddDocuments(batch);
+    for (size_t i = batch_size; i < documents.size(); ++i)
+    {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 7)});
+        sharded_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 7)});
+    }
+    for (size_t i = 0; i < documents.size(); i += removed_step)
+    {
+        search_server.RemoveDocument(i);
+        sharded_server.RemoveDocument(i);
+    }
+
+    // Term counts of the live documents by word, and their lengths.
+    map<string_view, vector<pair<int, int>>> word_to_term_counts;
+    vector<int> lengths(documents.size());
+    size_t live_count = 0;
+    double total_length = 0;
+    for (size_t id = 0; id < documents.size(); ++id)
+    {
+        if (id % removed_step == 0)
+        {
+            continue;
+        }
+        map<string_view, int> term_counts;
+        ForEachWordView(documents[id], [&](string_view word) {
+            if (!word.empty() && word != "and"sv && word != "with"sv)
+            {
+                ++term_counts[word];
+                ++lengths[id];
+            }
+        });
+        for (const auto &[word, term_count] : term_counts)
+        {
+            word_to_term_counts[word].emplace_back(id, term_count);
+        }
+        ++live_count;
+        total_length += lengths[id];
+    }
+    const double k1 = 1.2;
+    const double b = 0.75;
+    const double average_length = total_length / live_count;
+
+    vector<vector<Document>> results;
+    {
+        LOG_DURATION("tf-idf queries"s, std::cerr);
+        for (const string &query : queries)
+        {
+            results.push_back(search_server.FindTopDocuments(query));
+        }
+    }
+    results.clear();
+    {
+        LOG_DURATION("bm25 queries"s, std::cerr);
+        for (const string &query : queries)
+        {
+            results.push_back(search_server.FindTopDocuments<Bm25Ranking>(query, DocumentStatus::ACTUAL));
+        }
+    }
+    vector<vector<Document>> expected_results;
+    vector<vector<Document>> sharded_results;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        set<string_view> plus_words;
+        ForEachWordView(queries[i], [&](string_view word) {
+            if (!word.empty() && word != "and"sv && word != "with"sv)
+            {
+                plus_words.insert(word);
+            }
+        });
+        map<int, double> relevances;
+        for (const string_view word : plus_words)
+        {
+            const auto it = word_to_term_counts.find(word);
+            if (it == word_to_term_counts.end())
+            {
+                continue;
+            }
+            const double document_freq = it->second.size();
+            const double inverse_document_freq = log(1.0 + (live_count - document_freq + 0.5) / (document_freq + 0.5));
+            for (const auto &[id, term_count] : it->second)
+            {
+                relevances[id] += inverse_document_freq * term_count * (k1 + 1.0) / (term_count + k1 * (1.0 - b + b * lengths[id] / average_length));
+            }
+        }
+        vector<Document> expected;
+        for (const auto &[id, relevance] : relevances)
+        {
+            expected.push_back({id, relevance, id % 7});
+        }
+        sort(expected.begin(), expected.end(), SearchServer::IsMoreRelevant);
+        expected.resize(min(expected.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT)));
+
+        expected_results.push_back(move(expected));
+        sharded_results.push_back(sharded_server.FindTopDocuments<Bm25Ranking>(queries[i], [](int document_id, DocumentStatus status, int rating) {
+            return status == DocumentStatus::ACTUAL;
+        }));
+    }
+    const DocumentComparison comparison{.tolerance = 1e-9, .ratings = true};
+    Check("bm25"s, CountMismatches(results, expected_results, comparison));
+    Check("sharded bm25"s, CountMismatches(sharded_results, expected_results, comparison));
+
+    // Every execution policy ranks alike.
+    ThreadPool thread_pool(2);
+    vector<vector<Document>> par_results;
+    vector<vector<Document>> pool_results;
+    for (const string &query : queries)
+    {
+        par_results.push_back(search_server.FindTopDocuments<Bm25Ranking>(execution::par, query, DocumentStatus::ACTUAL));
+        pool_results.push_back(search_server.FindTopDocuments<Bm25Ranking>(thread_pool.Policy(), query));
+    }
+    Check("bm25 par"s, CountMismatches(par_results, expected_results, comparison));
+    Check("bm25 pool"s, CountMismatches(pool_results, expected_results, comparison));
+}
+
+// Structured filters against the same conditions given as a predicate.
+void TestDocumentFilter(const vector<string> &documents, const vector<string> &queries)
+{
+    const vector<DocumentStatus> statuses = {DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT, DocumentStatus::BANNED, DocumentStatus::REMOVED};
+    const auto status_of = [&statuses](int id) {
+        return statuses[id % 7 == 0 ? 1 + id % 3 : 0];
+    };
+    const auto rating_of = [](int id) {
+        return id % 21 - 10;
+    };
+    SearchServer search_server("and with"s);
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        search_server.AddDocument(i, documents[i], status_of(i), {rating_of(i)});
+    }
+    for (size_t i = 0; i < documents.size(); i += 5)
+    {
+        search_server.RemoveDocument(i);
+    }
+
+    vector<vector<Document>> results;
+    {
+        LOG_DURATION("status predicate"s, std::cerr);
+        for (const string &query : queries)
+        {
+            results.push_back(search_server.FindTopDocuments(query, [](int document_id, DocumentStatus status, int rating) {
+                return status == DocumentStatus::ACTUAL;
+            }));
+        }
+    }
+    vector<vector<Document>> found;
+    {
+        LOG_DURATION("status filter"s, std::cerr);
+        DocumentFilter filter;
+        filter.statuses = {DocumentStatus::ACTUAL};
+        for (const string &query : queries)
+        {
+            found.push_back(search_server.FindTopDocuments(query, filter));
+        }
+    }
+    const DocumentComparison comparison{.tolerance = 0, .ids = true};
+    Check("status filter"s, CountMismatches(found, results, comparison));
+
+    mt19937 generator;
+    vector<vector<Document>> expected;
+    found.clear();
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        DocumentFilter filter;
+        filter.statuses.clear();
+        for (const DocumentStatus status : statuses)
+        {
+            if (uniform_int_distribution(0, 1)(generator))
+            {
+                filter.statuses.push_back(status);
+            }
+        }
+        filter.min_rating = uniform_int_distribution(-12, 5)(generator);
+        filter.max_rating = filter.min_rating + uniform_int_distribution(0, 15)(generator);
+        set<int> allowed_ids;
+        if (i % 2 == 0)
+        {
+            filter.allowed_ids.emplace();
+            for (int j = 0; j < 2000; ++j)
+            {
+                const int id = uniform_int_distribution<int>(0, documents.size() + 100)(generator);
+                filter.allowed_ids->push_back(id);
+                allowed_ids.insert(id);
+            }
+        }
+        set<int> denied_ids;
+        for (int j = 0; j < 200; ++j)
+        {
+            const int id = uniform_int_distribution<int>(0, documents.size() + 100)(generator);
+            filter.denied_ids.push_back(id);
+            denied_ids.insert(id);
+        }
+        const auto predicate = [&](int document_id, DocumentStatus status, int rating) {
+            return find(filter.statuses.begin(), filter.statuses.end(), status) != filter.statuses.end() && rating >= filter.min_rating
+                   && rating <= filter.max_rating && (!filter.allowed_ids || allowed_ids.count(document_id) != 0) && denied_ids.count(document_id) == 0;
+        };
+        expected.push_back(search_server.FindTopDocuments(queries[i], predicate));
+        found.push_back(search_server.FindTopDocuments(queries[i], filter));
+    }
+    Check("filters"s, CountMismatches(found, expected, comparison));
+}
+
+// Bulk matching against MatchDocument on every live document.
+void TestMatchAllDocuments(const vector<string> &documents, const vector<string> &queries)
+{
+    SearchServer search_server("and with"s);
+    search_server.EnablePositions();
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        search_server.AddDocument(i, documents[i], i % 9 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {1});
+    }
+    for (size_t i = 0; i < documents.size(); i += 6)
+    {
+        search_server.RemoveDocument(i);
+    }
+
+    vector<vector<tuple<int, vector<string_view>, DocumentStatus>>> expected(queries.size());
+    {
+        LOG_DURATION("match per document"s, std::cerr);
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            for (const int document_id : search_server)
+            {
+                const auto [words, status] = search_server.MatchDocument(queries[i], document_id);
+                expected[i].emplace_back(document_id, words, status);
+            }
+        }
+    }
+    const auto count_mismatches = [&](const vector<DocumentMatches> &results) {
+        int mismatch_count = 0;
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            bool equal = results[i].Size() == expected[i].size();
+            for (size_t j = 0; equal && j < expected[i].size(); ++j)
+            {
+                equal = results[i].document_ids[j] == get<0>(expected[i][j]) && results[i].MatchedWords(j) == get<1>(expected[i][j])
+                        && results[i].statuses[j] == get<2>(expected[i][j]);
+            }
+            mismatch_count += !equal;
+        }
+        return mismatch_count;
+    };
+    vector<DocumentMatches> results;
+    {
+        LOG_DURATION("match all seq"s, std::cerr);
+        for (const string &query : queries)
+        {
+            results.push_back(search_server.MatchAllDocuments(execution::seq, query));
+        }
+    }
+    int mismatch_count = count_mismatches(results);
+    results.clear();
+    {
+        LOG_DURATION("match all par"s, std::cerr);
+        for (const string &query : queries)
+        {
+            results.push_back(search_server.MatchAllDocuments(execution::par, query));
+        }
+    }
+    mismatch_count += count_mismatches(results);
+    Check("match all"s, mismatch_count);
+}
+
+// Ingests, queries and matches on pools of 1 to max(4, core count)
+// threads, against the sequential results. Queries nested in a task of the
+// pool share its threads, and an exception of a task reaches the caller.
+// Documents of equal relevance may come in any order.
+void TestThreadPool(const vector<string> &documents, const vector<string> &queries)
+{
+    vector<DocumentInput> batch = MakeBatch(documents, documents.size());
+    for (size_t i = 0; i < batch.size(); i += 7)
+    {
+        batch[i].status = DocumentStatus::BANNED;
+    }
+    SearchServer reference_server("and with"s);
+    reference_server.AddDocuments(execution::seq, batch);
+    const vector<vector<Document>> expected = FindTopDocumentsOfEach(reference_server, queries);
+    const DocumentMatches expected_matches = reference_server.MatchAllDocuments(execution::seq, queries[0]);
+
+    int mismatch_count = 0;
+    const size_t max_thread_count = max<size_t>(4, thread::hardware_concurrency());
+    for (size_t thread_count = 1; thread_count <= max_thread_count; ++thread_count)
+    {
+        ThreadPool thread_pool(thread_count, thread_count == max_thread_count);
+        const string mark = " "s + to_string(thread_count) + (thread_count == 1 ? " thread"s : " threads"s);
+        SearchServer search_server("and with"s);
+        {
+            LOG_DURATION("pool ingest"s + mark, std::cerr);
+            search_server.AddDocuments(thread_pool.Policy(), batch);
+        }
+        vector<vector<Document>> found(queries.size());
+        {
+            LOG_DURATION("pool queries"s + mark, std::cerr);
+            for (size_t i = 0; i < queries.size(); ++i)
+            {
+                found[i] = search_server.FindTopDocuments(thread_pool.Policy(), queries[i]);
+            }
+        }
+        mismatch_count += CountMismatches(found, expected);
+        {
+            LOG_DURATION("pool batch"s + mark, std::cerr);
+            found = ProcessQueries(search_server, queries, thread_pool);
+        }
+        mismatch_count += CountMismatches(found, expected);
+        {
+            LOG_DURATION("pool nested queries"s + mark, std::cerr);
+            thread_pool.ParallelFor(queries.size(), [&](size_t i) {
+                found[i] = search_server.FindTopDocuments(thread_pool.Policy(), queries[i]);
+            });
+        }
+        mismatch_count += CountMismatches(found, expected);
+        const DocumentMatches matches = search_server.MatchAllDocuments(thread_pool.Policy(), queries[0]);
+        mismatch_count += matches.document_ids != expected_matches.document_ids || matches.word_indexes != expected_matches.word_indexes;
+        try
+        {
+            thread_pool.ParallelFor(100, [&](size_t i) {
+                if (i == 42)
+                {
+                    search_server.FindTopDocuments(thread_pool.Policy(), "-"s);
+                }
+            });
+            ++mismatch_count;
+        }
+        catch (const invalid_argument &)
+        {
+        }
+    }
+    Check("thread pool"s, mismatch_count);
+}
+
+template <typename Decoder>
+void TestPostingDecoding(string_view mark, const vector<PostingBlockHeader> &blocks, const pmr::vector<uint32_t> &data, size_t posting_count, Decoder decoder)
+{
+    const int repeat_count = 100;
+    uint32_t ordinals[POSTING_BLOCK_SIZE];
+    uint32_t term_counts[POSTING_BLOCK_SIZE];
+    uint64_t checksum = 0;
+    const auto start_time = chrono::steady_clock::now();
+    for (int i = 0; i < repeat_count; ++i)
+    {
+        for (const PostingBlockHeader &header : blocks)
+        {
+            decoder(header, data.data(), ordinals, term_counts);
+            checksum += ordinals[header.size - 1] + term_counts[0];
+        }
+    }
+    const auto duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start_time);
+    cout << checksum << endl;
+    cerr << mark << ": "s << posting_count * repeat_count / max<int64_t>(duration.count(), 1) << " M postings/s"s << endl;
+}
+
+void TestSnapshot(const SearchServer &search_server, const vector<string> &queries)
+{
+    const string path = "search_server.snapshot"s;
+    {
+        LOG_DURATION("Snapshot save"s, cerr);
+        search_server.SaveSnapshot(path);
+    }
+    const auto start_time = chrono::steady_clock::now();
+    const SearchServer loaded_server = SearchServer::LoadSnapshot(path);
+    const auto duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start_time);
+    cerr << "Snapshot load: "s << duration.count() << " us"s << endl;
+    Test("snapshot seq"s, loaded_server, queries, execution::seq);
+    remove(path.c_str());
+}
+
+void TestPostingCodec(const vector<string> &documents)
+{
+    map<string_view, vector<Posting>> word_to_postings;
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        for (const string_view word : SplitIntoWordsView(documents[i]))
+        {
+            auto &postings = word_to_postings[word];
+            if (!postings.empty() && postings.back().document_ordinal == i)
+            {
+                ++postings.back().term_count;
+            }
+            else
+            {
+                postings.push_back({static_cast<uint32_t>(i), 1});
+            }
+        }
+    }
+
+    vector<PostingBlockHeader> blocks;
+    pmr::vector<uint32_t> data;
+    size_t posting_count = 0;
+    for (const auto &[word, postings] : word_to_postings)
+    {
+        for (size_t i = 0; i < postings.size(); i += POSTING_BLOCK_SIZE)
+        {
+            blocks.push_back(EncodePostingBlock(postings.data() + i, min(POSTING_BLOCK_SIZE, postings.size() - i), data));
+        }
+        posting_count += postings.size();
+    }
+    const size_t bytes = blocks.size() * sizeof(PostingBlockHeader) + data.size() * sizeof(uint32_t);
+    cerr << "Compressed postings: "s << bytes * 1.0 / posting_count << " bytes/posting, uncompressed "s << sizeof(Posting) << endl;
+
+    TestPostingDecoding("decode simd"s, blocks, data, posting_count, DecodePostingBlock);
+    TestPostingDecoding("decode scalar"s, blocks, data, posting_count, DecodePostingBlockScalar);
+}
+
 int main()
 {
     mt19937 generator;
@@ -89,13 +1071,56 @@ int main()
     const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
 
     SearchServer search_server(dictionary[0]);
-    for (size_t i = 0; i < documents.size(); ++i)
+    const size_t memory_before_index = GetResidentMemoryKb();
     {
-        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+        LOG_DURATION("Index build"s, cerr);
+        AddEach(search_server, documents, 0, documents.size());
     }
+    cerr << "Index memory: "s << GetResidentMemoryKb() - memory_before_index << " kB"s << endl;
 
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
 
     TEST(seq);
     TEST(par);
+    TestPruned(search_server, queries, dictionary);
+    TestQueryParsing(search_server, queries);
+    TestSnapshot(search_server, queries);
+    const auto batch_queries = GenerateQueries(generator, dictionary, 1'000, 10);
+    TestProcessQueries(search_server, batch_queries);
+    TestProcessQueriesLazy(search_server, batch_queries);
+
+    const auto removal_dictionary = GenerateDictionary(generator, 10'000, 10);
+    const auto removal_documents = GenerateQueries(generator, removal_dictionary, 100'000, 20);
+
+    TestIngestLoop("ingest loop"s, removal_documents, false);
+    TestIngestLoop("ingest loop with positions"s, removal_documents, true);
+    TEST_INGEST(seq);
+    TEST_INGEST(par);
+
+    TEST_REMOVAL(seq);
+    TEST_REMOVAL(par);
+    TestShortQueries(removal_documents, removal_dictionary);
+    TestSkewedPruning(removal_dictionary);
+
+    const vector<string> update_documents(removal_documents.begin(), removal_documents.begin() + 30'000);
+    TestConcurrentUpdates(update_documents, GenerateQueries(generator, removal_dictionary, 100, 10));
+    TestQueryLatencyUnderIngest(update_documents, GenerateQueries(generator, removal_dictionary, 100, 10));
+    TestRemoveDuplicates(update_documents);
+    TestResultCache(update_documents, GenerateQueries(generator, removal_dictionary, 100, 10));
+    TestPhraseQueries(removal_documents);
+    TestRanking(update_documents, GenerateQueries(generator, removal_dictionary, 1'000, 5));
+    TestDocumentFilter(update_documents, GenerateQueries(generator, removal_dictionary, 1'000, 5));
+    vector<string> match_queries;
+    for (int i = 0; i < 20; ++i)
+    {
+        match_queries.push_back(GenerateQuery(generator, removal_dictionary, 10, 0.2));
+    }
+    match_queries.push_back("\""s + removal_documents[1].substr(0, removal_documents[1].find(' ', removal_documents[1].find(' ') + 1)) + "\" "s + match_queries[0]);
+    TestMatchAllDocuments(update_documents, match_queries);
+    TestShardedServer(removal_documents, GenerateQueries(generator, removal_dictionary, 1'000, 70));
+    TestArenas(removal_documents, GenerateQueries(generator, removal_dictionary, 10'000, 5));
+    TestThreadPool(update_documents, GenerateQueries(generator, removal_dictionary, 1'000, 10));
+
+    TestPostingCodec(documents);
+    return failed_check_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include <algorithm>
+
+#include "posting_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const size_t LANE_COUNT = 4;
+
+    uint8_t BitWidth(uint32_t value)
+    {
+        uint8_t bits = 0;
+        while (value != 0)
+        {
+            ++bits;
+            value >>= 1;
+        }
+        return bits;
+    }
+
+    size_t PackedWords(size_t count, uint8_t bits)
+    {
+        const size_t lane_values = (count + LANE_COUNT - 1) / LANE_COUNT;
+        return LANE_COUNT * ((lane_values * bits + 31) / 32);
+    }
+
+    // Value i goes to lane i % 4 at bit position (i / 4) * bits of that lane.
+    void Pack(const uint32_t *values, size_t count, uint8_t bits, std::pmr::vector<uint32_t> &data)
+    {
+        if (bits == 0)
+        {
+            return;
+        }
+        const size_t offset = data.size();
+        data.resize(offset + PackedWords(count, bits), 0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t bit = (i / LANE_COUNT) * bits;
+            const size_t lane = i % LANE_COUNT;
+            const size_t word = offset + (bit / 32) * LANE_COUNT + lane;
+            const size_t shift = bit % 32;
+            data[word] |= values[i] << shift;
+            if (shift + bits > 32)
+            {
+                data[word + LANE_COUNT] |= values[i] >> (32 - shift);
+            }
+        }
+    }
+
+    void UnpackScalar(const uint32_t *data, size_t count, uint8_t bits, uint32_t *values)
+    {
+        if (bits == 0)
+        {
+            std::fill(values, values + count, 0);
+            return;
+        }
+        const uint32_t mask = bits == 32 ? ~uint32_t{0} : (uint32_t{1} << bits) - 1;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t bit = (i / LANE_COUNT) * bits;
+            const size_t word = (bit / 32) * LANE_COUNT + i % LANE_COUNT;
+            const size_t shift = bit % 32;
+            uint32_t value = data[word] >> shift;
+            if (shift + bits > 32)
+            {
+                value |= data[word + LANE_COUNT] << (32 - shift);
+            }
+            values[i] = value & mask;
+        }
+    }
+
+    void PrefixSumScalar(uint32_t *values, size_t count, uint32_t base)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            base += values[i];
+            values[i] = base;
+        }
+    }
+
+#if defined(__SSE2__)
+    // Unpacks whole groups of four values; count must be a multiple of 4
+    // and values must have room for it.
+    void UnpackSse2(const uint32_t *data, size_t count, uint8_t bits, uint32_t *values)
+    {
+        if (bits == 0)
+        {
+            std::fill(values, values + count, 0);
+            return;
+        }
+        const __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : static_cast<int>((uint32_t{1} << bits) - 1));
+        const __m128i *words = reinterpret_cast<const __m128i *>(data);
+        for (size_t group = 0; group < count / LANE_COUNT; ++group)
+        {
+            const size_t bit = group * bits;
+            const size_t word = bit / 32;
+            const int shift = bit % 32;
+            __m128i value = _mm_srl_epi32(_mm_loadu_si128(words + word), _mm_cvtsi32_si128(shift));
+            if (shift + bits > 32)
+            {
+                value = _mm_or_si128(value, _mm_sll_epi32(_mm_loadu_si128(words + word + 1), _mm_cvtsi32_si128(32 - shift)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(values) + group, _mm_and_si128(value, mask));
+        }
+    }
+
+    void PrefixSumSse2(uint32_t *values, size_t count, uint32_t base)
+    {
+        __m128i carry = _mm_set1_epi32(static_cast<int>(base));
+        __m128i *groups = reinterpret_cast<__m128i *>(values);
+        for (size_t group = 0; group < count / LANE_COUNT; ++group)
+        {
+            __m128i value = _mm_loadu_si128(groups + group);
+            value = _mm_add_epi32(value, _mm_slli_si128(value, 4));
+            value = _mm_add_epi32(value, _mm_slli_si128(value, 8));
+            value = _mm_add_epi32(value, carry);
+            _mm_storeu_si128(groups + group, value);
+            carry = _mm_shuffle_epi32(value, 0xFF);
+        }
+    }
+#endif
+}
+
+PostingBlockHeader EncodePostingBlock(const Posting *postings, size_t count, std::pmr::vector<uint32_t> &data)
+{
+    uint32_t deltas[POSTING_BLOCK_SIZE];
+    uint32_t term_counts[POSTING_BLOCK_SIZE];
+    uint32_t max_delta = 0;
+    uint32_t max_term_count = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        deltas[i] = i == 0 ? 0 : postings[i].document_ordinal - postings[i - 1].document_ordinal;
+        term_counts[i] = postings[i].term_count - 1;
+        max_delta = std::max(max_delta, deltas[i]);
+        max_term_count = std::max(max_term_count, term_counts[i]);
+    }
+
+    PostingBlockHeader header;
+    header.first_ordinal = postings[0].document_ordinal;
+    header.last_ordinal = postings[count - 1].document_ordinal;
+    header.data_offset = data.size();
+    header.size = count;
+    header.delta_bits = BitWidth(max_delta);
+    header.term_count_bits = BitWidth(max_term_count);
+    header.reserved = 0;
+    Pack(deltas, count, header.delta_bits, data);
+    Pack(term_counts, count, header.term_count_bits, data);
+    return header;
+}
+
+size_t PostingBlockWords(const PostingBlockHeader &header)
+{
+    return PackedWords(header.size, header.delta_bits) + PackedWords(header.size, header.term_count_bits);
+}
+
+void DecodePostingBlock(const PostingBlockHeader &header, const uint32_t *data, uint32_t *ordinals, uint32_t *term_counts)
+{
+#if defined(__SSE2__)
+    const uint32_t *block = data + header.data_offset;
+    const uint32_t *term_count_words = block + PackedWords(header.size, header.delta_bits);
+    const size_t padded_size = (header.size + LANE_COUNT - 1) / LANE_COUNT * LANE_COUNT;
+    UnpackSse2(block, padded_size, header.delta_bits, ordinals);
+    PrefixSumSse2(ordinals, padded_size, header.first_ordinal);
+    UnpackSse2(term_count_words, padded_size, header.term_count_bits, term_counts);
+    for (size_t i = 0; i < header.size; ++i)
+    {
+        ++term_counts[i];
+    }
+#else
+    DecodePostingBlockScalar(header, data, ordinals, term_counts);
+#endif
+}
+
+void DecodePostingBlockScalar(const PostingBlockHeader &header, const uint32_t *data, uint32_t *ordinals, uint32_t *term_counts)
+{
+    const uint32_t *block = data + header.data_offset;
+    const uint32_t *term_count_words = block + PackedWords(header.size, header.delta_bits);
+    UnpackScalar(block, header.size, header.delta_bits, ordinals);
+    PrefixSumScalar(ordinals, header.size, header.first_ordinal);
+    UnpackScalar(term_count_words, header.size, header.term_count_bits, term_counts);
+    for (size_t i = 0; i < header.size; ++i)
+    {
+        ++term_counts[i];
+    }
+}
+
+size_t EncodeVarint(uint32_t value, uint8_t *bytes)
+{
+    size_t size = 0;
+    while (value >= 0x80)
+    {
+        bytes[size++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = static_cast<uint8_t>(value);
+    return size;
+}
+
+const uint8_t *DecodeVarint(const uint8_t *bytes, uint32_t &value)
+{
+    value = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        const uint8_t byte = *bytes++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            return bytes;
+        }
+    }
+}
\ No newline at end of file
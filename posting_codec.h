@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+static const size_t POSTING_BLOCK_SIZE = 128;
+
+struct Posting
+{
+    uint32_t document_ordinal;
+    uint32_t term_count;
+};
+
+// Skip entry of one compressed block. Ordinal deltas and term counts are
+// bit-packed at fixed widths into 4 interleaved 32-bit lanes, so that a
+// 128-bit register unpacks four consecutive postings at once.
+struct PostingBlockHeader
+{
+    uint32_t first_ordinal;
+    uint32_t last_ordinal;
+    uint32_t data_offset;
+    uint8_t size;
+    uint8_t delta_bits;
+    uint8_t term_count_bits;
+    uint8_t reserved;
+};
+
+// Appends up to POSTING_BLOCK_SIZE postings, sorted by ordinal, to data.
+PostingBlockHeader EncodePostingBlock(const Posting *postings, size_t count, std::pmr::vector<uint32_t> &data);
+
+// Number of 32-bit words the block occupies in the data array.
+size_t PostingBlockWords(const PostingBlockHeader &header);
+
+// Decodes a block into arrays of at least POSTING_BLOCK_SIZE elements.
+// Uses SSE2 when available and the scalar decoder otherwise.
+void DecodePostingBlock(const PostingBlockHeader &header, const uint32_t *data, uint32_t *ordinals, uint32_t *term_counts);
+
+void DecodePostingBlockScalar(const PostingBlockHeader &header, const uint32_t *data, uint32_t *ordinals, uint32_t *term_counts);
+
+// Longest encoding of a 32-bit value by EncodeVarint.
+static const size_t VARINT_MAX_BYTES = 5;
+
+// Writes value in 7-bit groups, low group first, with the high bit of a
+// byte set when more follow. Returns the number of bytes written.
+size_t EncodeVarint(uint32_t value, uint8_t *bytes);
+
+// Returns the byte after the value.
+const uint8_t *DecodeVarint(const uint8_t *bytes, uint32_t &value);
\ No newline at end of file
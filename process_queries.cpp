@@ -1,28 +1,195 @@
 #include "process_queries.h"
-#include <functional>
-#include <numeric>
 
-std::vector<std::vector<Document>> ProcessQueries(const SearchServer &search_server, const std::vector<std::string> &queries)
+namespace
 {
-    std::vector<std::vector<Document>> documents(queries.size());
+    bool IsActual(int document_id, DocumentStatus status, int rating)
+    {
+        return status == DocumentStatus::ACTUAL;
+    }
+
+    template <typename ExecutionPolicy>
+    std::vector<std::vector<Document>> ProcessQueriesWith(const ExecutionPolicy &execution_policy, const SearchServer &search_server, const std::vector<std::string> &queries)
+    {
+        std::vector<std::vector<Document>> documents(queries.size());
+        search_server.FindTopDocumentsBatch(execution_policy, queries, IsActual, [&documents](size_t query_index, std::vector<Document> &&query_documents) {
+            documents[query_index] = std::move(query_documents);
+        });
+        return documents;
+    }
 
-    std::transform(std::execution::par, queries.begin(), queries.end(), documents.begin(),
-                   [&search_server](const std::string &query) {
-                       return search_server.FindTopDocuments(query);
-                   });
-    return documents;
+    // Results are appended as the batch produces them, without keeping a
+    // vector per query.
+    template <typename ExecutionPolicy>
+    std::vector<Document> ProcessQueriesJoinedWith(const ExecutionPolicy &execution_policy, const SearchServer &search_server, const std::vector<std::string> &queries)
+    {
+        std::vector<Document> documents;
+        documents.reserve(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+        search_server.FindTopDocumentsBatch(execution_policy, queries, IsActual, [&documents](size_t query_index, std::vector<Document> &&query_documents) {
+            documents.insert(documents.end(), query_documents.begin(), query_documents.end());
+        });
+        return documents;
+    }
+}
+
+std::vector<std::vector<Document>> ProcessQueries(const SearchServer &search_server, const std::vector<std::string> &queries)
+{
+    return ProcessQueriesWith(std::execution::par, search_server, queries);
 }
 
 std::vector<Document> ProcessQueriesJoined(const SearchServer &search_server, const std::vector<std::string> &queries)
 {
-    std::vector<std::vector<Document>> vector_documents = ProcessQueries(search_server, queries);
-    size_t size = std::transform_reduce(std::execution::par, vector_documents.begin(), vector_documents.end(), 0, std::plus<>{}, [](std::vector<Document> &doc) { return doc.size(); });
-    std::vector<Document> documents(size);
-    auto it = documents.begin();
-    for (const auto &document : vector_documents)
+    return ProcessQueriesJoinedWith(std::execution::par, search_server, queries);
+}
+
+std::vector<std::vector<Document>> ProcessQueries(const SearchServer &search_server, const std::vector<std::string> &queries, ThreadPool &thread_pool)
+{
+    return ProcessQueriesWith(thread_pool.Policy(), search_server, queries);
+}
+
+std::vector<Document> ProcessQueriesJoined(const SearchServer &search_server, const std::vector<std::string> &queries, ThreadPool &thread_pool)
+{
+    return ProcessQueriesJoinedWith(thread_pool.Policy(), search_server, queries);
+}
+
+JoinedQueryResults::Iterator::Iterator(JoinedQueryResults *results)
+    : results_(results)
+{
+}
+
+JoinedQueryResults::Iterator::reference JoinedQueryResults::Iterator::operator*() const
+{
+    return results_->CurrentDocument();
+}
+
+JoinedQueryResults::Iterator::pointer JoinedQueryResults::Iterator::operator->() const
+{
+    return &results_->CurrentDocument();
+}
+
+JoinedQueryResults::Iterator &JoinedQueryResults::Iterator::operator++()
+{
+    results_->Advance();
+    return *this;
+}
+
+void JoinedQueryResults::Iterator::operator++(int)
+{
+    results_->Advance();
+}
+
+bool JoinedQueryResults::Iterator::operator==(const Iterator &other) const
+{
+    return AtEnd() == other.AtEnd() && (AtEnd() || results_ == other.results_);
+}
+
+bool JoinedQueryResults::Iterator::operator!=(const Iterator &other) const
+{
+    return !(*this == other);
+}
+
+bool JoinedQueryResults::Iterator::AtEnd() const
+{
+    return results_ == nullptr || results_->AtEnd();
+}
+
+JoinedQueryResults::JoinedQueryResults(const SearchServer &search_server, const std::vector<std::string> &queries, size_t window, size_t thread_count)
+    : search_server_(search_server), queries_(queries), slots_(std::max<size_t>(window, 1))
+{
+    for (size_t i = 0; i < std::max<size_t>(thread_count, 1); ++i)
     {
-        std::transform(std::execution::par, document.begin(), document.end(), it, [](auto &doc) { return doc; });
-        it += document.size();
+        producers_.emplace_back([this](std::stop_token stop_token) {
+            Produce(stop_token);
+        });
     }
-    return documents;
+}
+
+JoinedQueryResults::Iterator JoinedQueryResults::begin()
+{
+    if (!started_)
+    {
+        started_ = true;
+        SkipEmptyResults();
+    }
+    return Iterator(this);
+}
+
+JoinedQueryResults::Iterator JoinedQueryResults::end()
+{
+    return Iterator();
+}
+
+// Runs on every producer. A query is taken only once its slot has been
+// released by the consumer, so results are never overwritten unread.
+void JoinedQueryResults::Produce(std::stop_token stop_token)
+{
+    std::unique_lock lock(mutex_);
+    const auto can_produce = [this]() {
+        return next_query_ >= queries_.size() || next_query_ < current_query_ + slots_.size();
+    };
+    while (slot_freed_.wait(lock, stop_token, can_produce) && !stop_token.stop_requested() && next_query_ < queries_.size())
+    {
+        const size_t query = next_query_++;
+        lock.unlock();
+        Slot slot;
+        slot.ready = true;
+        try
+        {
+            slot.documents = search_server_.FindTopDocuments(queries_[query]);
+        }
+        catch (...)
+        {
+            slot.error = std::current_exception();
+        }
+        lock.lock();
+        slots_[query % slots_.size()] = std::move(slot);
+        slot_ready_.notify_all();
+    }
+}
+
+void JoinedQueryResults::SkipEmptyResults()
+{
+    std::unique_lock lock(mutex_);
+    while (current_query_ < queries_.size())
+    {
+        Slot &slot = slots_[current_query_ % slots_.size()];
+        slot_ready_.wait(lock, [&slot]() {
+            return slot.ready;
+        });
+        if (!slot.error && current_document_ < slot.documents.size())
+        {
+            return;
+        }
+        const std::exception_ptr error = slot.error;
+        slot = Slot();
+        ++current_query_;
+        current_document_ = 0;
+        slot_freed_.notify_all();
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void JoinedQueryResults::Advance()
+{
+    ++current_document_;
+    SkipEmptyResults();
+}
+
+bool JoinedQueryResults::AtEnd() const
+{
+    return current_query_ >= queries_.size();
+}
+
+// The slot of the current query is only written by the consumer until it
+// is released.
+const Document &JoinedQueryResults::CurrentDocument() const
+{
+    return slots_[current_query_ % slots_.size()].documents[current_document_];
+}
+
+JoinedQueryResults ProcessQueriesJoinedLazy(const SearchServer &search_server, const std::vector<std::string> &queries, size_t window)
+{
+    return JoinedQueryResults(search_server, queries, window);
 }
\ No newline at end of file
@@ -1,7 +1,116 @@
 #pragma once
 
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+
 #include "search_server.h"
+#include "thread_pool.h"
+
+// Queries whose results may be computed ahead of the consumer of a
+// JoinedQueryResults.
+static const size_t QUERY_PIPELINE_WINDOW = 64;
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer &search_server, const std::vector<std::string> &queries);
 
-std::vector<Document> ProcessQueriesJoined(const SearchServer &search_server, const std::vector<std::string> &queries);
\ No newline at end of file
+std::vector<Document> ProcessQueriesJoined(const SearchServer &search_server, const std::vector<std::string> &queries);
+
+// Answers the queries on the threads of the pool instead of the standard
+// parallel algorithms.
+std::vector<std::vector<Document>> ProcessQueries(const SearchServer &search_server, const std::vector<std::string> &queries, ThreadPool &thread_pool);
+
+std::vector<Document> ProcessQueriesJoined(const SearchServer &search_server, const std::vector<std::string> &queries, ThreadPool &thread_pool);
+
+// Results of ProcessQueriesJoined, computed by a pool of producer threads
+// while the consumer iterates. At most window queries are in flight or
+// waiting to be consumed; producers stop when the object is destroyed.
+// The range can be iterated once. A query that fails rethrows its
+// exception when the iteration reaches it.
+class JoinedQueryResults
+{
+public:
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Document;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Document *;
+        using reference = const Document &;
+
+        Iterator() = default;
+
+        explicit Iterator(JoinedQueryResults *results);
+
+        reference operator*() const;
+
+        pointer operator->() const;
+
+        Iterator &operator++();
+
+        void operator++(int);
+
+        bool operator==(const Iterator &other) const;
+
+        bool operator!=(const Iterator &other) const;
+
+    private:
+        JoinedQueryResults *results_ = nullptr;
+
+        bool AtEnd() const;
+    };
+
+    JoinedQueryResults(const SearchServer &search_server, const std::vector<std::string> &queries, size_t window = QUERY_PIPELINE_WINDOW,
+                       size_t thread_count = NUMBER_PARALLEL_PROCESSES);
+
+    JoinedQueryResults(const JoinedQueryResults &) = delete;
+
+    JoinedQueryResults &operator=(const JoinedQueryResults &) = delete;
+
+    Iterator begin();
+
+    Iterator end();
+
+private:
+    struct Slot
+    {
+        bool ready = false;
+        std::vector<Document> documents;
+        std::exception_ptr error;
+    };
+
+    const SearchServer &search_server_;
+    const std::vector<std::string> &queries_;
+    // Query i is produced into slots_[i % slots_.size()].
+    std::vector<Slot> slots_;
+
+    std::mutex mutex_;
+    std::condition_variable_any slot_ready_;
+    std::condition_variable_any slot_freed_;
+    size_t next_query_ = 0;
+    // Query whose result the consumer is reading, and the position in it.
+    size_t current_query_ = 0;
+    size_t current_document_ = 0;
+    bool started_ = false;
+
+    // Declared last so that they are stopped before the slots are destroyed.
+    std::vector<std::jthread> producers_;
+
+    void Produce(std::stop_token stop_token);
+
+    // Moves to the first document of the next non-empty result, waiting for
+    // it to be produced.
+    void SkipEmptyResults();
+
+    void Advance();
+
+    bool AtEnd() const;
+
+    const Document &CurrentDocument() const;
+};
+
+JoinedQueryResults ProcessQueriesJoinedLazy(const SearchServer &search_server, const std::vector<std::string> &queries,
+                                            size_t window = QUERY_PIPELINE_WINDOW);
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Ranking functions are template parameters of FindTopDocuments, so that
+// scoring a posting is inlined into the posting walk. A ranking is built
+// once per query from the size of the collection; it weighs each query
+// word by the number of documents containing it, then scores a posting
+// from the weight of its word, its term count and the length of its
+// document in words, stop words left out.
+
+// Term frequency times inverse document frequency.
+class TfIdfRanking
+{
+public:
+    TfIdfRanking(size_t document_count, uint64_t word_count)
+        : document_count_(document_count)
+    {
+    }
+
+    double WordWeight(uint32_t word_document_count) const
+    {
+        return std::log(document_count_ * 1.0 / word_document_count);
+    }
+
+    double Score(double word_weight, uint32_t term_count, uint32_t document_length) const
+    {
+        return term_count * 1.0 / document_length * word_weight;
+    }
+
+private:
+    size_t document_count_;
+};
+
+// Okapi BM25. The length normalization K1 * (1 - B + B * length / average
+// length) is precomputed as a linear function of the length.
+class Bm25Ranking
+{
+public:
+    static constexpr double K1 = 1.2;
+    static constexpr double B = 0.75;
+
+    Bm25Ranking(size_t document_count, uint64_t word_count)
+        : document_count_(document_count), length_norm_base_(K1 * (1.0 - B)),
+          length_norm_slope_(word_count == 0 ? 0.0 : K1 * B * document_count / word_count)
+    {
+    }
+
+    double WordWeight(uint32_t word_document_count) const
+    {
+        return std::log(1.0 + (document_count_ * 1.0 - word_document_count + 0.5) / (word_document_count + 0.5));
+    }
+
+    double Score(double word_weight, uint32_t term_count, uint32_t document_length) const
+    {
+        return word_weight * term_count * (K1 + 1.0) / (term_count + length_norm_base_ + length_norm_slope_ * document_length);
+    }
+
+private:
+    size_t document_count_;
+    double length_norm_base_;
+    double length_norm_slope_;
+};
\ No newline at end of file
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bitmap.h"
+
+// Relevance scores of one query in flat arrays indexed by document
+// ordinal. Accumulators are lent to the queries of a thread and reused:
+// the ordinals a query touches are listed, and only those are cleared for
+// the next query, so a query does not pay for the size of the index. Add
+// may run concurrently as long as the callers touch distinct ordinals,
+// which holds while walking a single posting list.
+class RelevanceAccumulator
+{
+public:
+    // An accumulator on loan; it is cleared and taken back when the lease
+    // ends.
+    class Lease
+    {
+    public:
+        explicit Lease(std::unique_ptr<RelevanceAccumulator> accumulator)
+            : accumulator_(std::move(accumulator))
+        {
+        }
+
+        Lease(Lease &&) = default;
+
+        Lease &operator=(const Lease &) = delete;
+
+        ~Lease()
+        {
+            if (accumulator_ != nullptr)
+            {
+                accumulator_->Clear();
+                FreeAccumulators().push_back(std::move(accumulator_));
+            }
+        }
+
+        RelevanceAccumulator &operator*() const
+        {
+            return *accumulator_;
+        }
+
+        RelevanceAccumulator *operator->() const
+        {
+            return accumulator_.get();
+        }
+
+    private:
+        std::unique_ptr<RelevanceAccumulator> accumulator_;
+    };
+
+    // Lends an accumulator of the calling thread covering ordinal_count
+    // ordinals. Queries nested on one thread get one each. The arrays of an
+    // accumulator grow with the index and are kept at their largest size.
+    static Lease Lend(size_t ordinal_count)
+    {
+        std::vector<std::unique_ptr<RelevanceAccumulator>> &free_accumulators = FreeAccumulators();
+        std::unique_ptr<RelevanceAccumulator> accumulator;
+        if (free_accumulators.empty())
+        {
+            accumulator = std::make_unique<RelevanceAccumulator>();
+        }
+        else
+        {
+            accumulator = std::move(free_accumulators.back());
+            free_accumulators.pop_back();
+        }
+        accumulator->Reserve(ordinal_count);
+        return Lease(std::move(accumulator));
+    }
+
+    void Exclude(uint32_t ordinal)
+    {
+        if (states_[ordinal] == UNTOUCHED)
+        {
+            Touch(ordinal);
+        }
+        states_[ordinal] = EXCLUDED;
+    }
+
+    // Excludes the ordinals set in ordinals, which must outlive the lease,
+    // without copying them.
+    void Exclude(const Bitmap &ordinals)
+    {
+        excluded_ = &ordinals;
+    }
+
+    bool IsExcluded(uint32_t ordinal) const
+    {
+        return states_[ordinal] == EXCLUDED || (excluded_ != nullptr && excluded_->Test(ordinal));
+    }
+
+    void Add(uint32_t ordinal, double relevance)
+    {
+        if (states_[ordinal] == UNTOUCHED)
+        {
+            Touch(ordinal);
+            states_[ordinal] = SCORED;
+        }
+        relevances_[ordinal] += relevance;
+    }
+
+    // Hands out the score of a scored ordinal once; later calls for the
+    // same ordinal return false, so postings of several words can be
+    // walked to collect every document exactly once.
+    bool Take(uint32_t ordinal, double &relevance)
+    {
+        if (states_[ordinal] != SCORED)
+        {
+            return false;
+        }
+        states_[ordinal] = TAKEN;
+        relevance = relevances_[ordinal];
+        return true;
+    }
+
+private:
+    enum State : char
+    {
+        UNTOUCHED,
+        SCORED,
+        TAKEN,
+        EXCLUDED,
+    };
+
+    std::vector<double> relevances_;
+    std::vector<State> states_;
+    // The first touched_count_ entries are the ordinals no longer
+    // UNTOUCHED. An ordinal is listed once, so the list never outgrows the
+    // ordinals.
+    std::vector<uint32_t> touched_;
+    std::atomic<size_t> touched_count_ = 0;
+    const Bitmap *excluded_ = nullptr;
+
+    static std::vector<std::unique_ptr<RelevanceAccumulator>> &FreeAccumulators()
+    {
+        static thread_local std::vector<std::unique_ptr<RelevanceAccumulator>> free_accumulators;
+        return free_accumulators;
+    }
+
+    void Reserve(size_t ordinal_count)
+    {
+        if (ordinal_count > states_.size())
+        {
+            relevances_.resize(ordinal_count, 0.0);
+            states_.resize(ordinal_count, UNTOUCHED);
+            touched_.resize(ordinal_count);
+        }
+    }
+
+    void Touch(uint32_t ordinal)
+    {
+        touched_[touched_count_.fetch_add(1, std::memory_order_relaxed)] = ordinal;
+    }
+
+    void Clear()
+    {
+        for (size_t i = 0; i < touched_count_; ++i)
+        {
+            relevances_[touched_[i]] = 0.0;
+            states_[touched_[i]] = UNTOUCHED;
+        }
+        touched_count_ = 0;
+        excluded_ = nullptr;
+    }
+};
\ No newline at end of file
@@ -1,31 +1,179 @@
 #include "remove_duplicates.h"
 
-void RemoveDuplicates(SearchServer &search_server)
+#include <cstdint>
+#include <execution>
+#include <limits>
+#include <unordered_map>
+
+namespace
 {
-    std::set<int> deleted_documents;
-    for (const int document_id_out : search_server)
+    const int MINHASH_BAND_COUNT = 16;
+
+    const int MINHASH_BAND_ROWS = 4;
+
+    uint64_t MixHash(uint64_t value)
+    {
+        value += 0x9e3779b97f4a7c15;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        return value ^ (value >> 31);
+    }
+
+    // The term frequencies are ordered by term id, so equal word sets give
+    // equal fingerprints.
+    uint64_t ComputeFingerprint(const std::vector<TermFrequency> &term_freqs)
+    {
+        uint64_t fingerprint = term_freqs.size();
+        for (const TermFrequency &term_freq : term_freqs)
+        {
+            fingerprint = MixHash(fingerprint ^ term_freq.term_id);
+        }
+        return fingerprint;
+    }
+
+    std::vector<uint64_t> ComputeMinHash(const std::vector<TermFrequency> &term_freqs)
+    {
+        std::vector<uint64_t> signature(MINHASH_BAND_COUNT * MINHASH_BAND_ROWS, std::numeric_limits<uint64_t>::max());
+        for (const TermFrequency &term_freq : term_freqs)
+        {
+            const uint64_t term_hash = MixHash(term_freq.term_id);
+            for (size_t i = 0; i < signature.size(); ++i)
+            {
+                signature[i] = std::min(signature[i], MixHash(term_hash + i * 0x9e3779b97f4a7c15));
+            }
+        }
+        return signature;
+    }
+
+    bool HaveSameTerms(const std::vector<TermFrequency> &lhs, const std::vector<TermFrequency> &rhs)
+    {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const TermFrequency &lhs, const TermFrequency &rhs) {
+            return lhs.term_id == rhs.term_id;
+        });
+    }
+
+    double ComputeSimilarity(const std::vector<TermFrequency> &lhs, const std::vector<TermFrequency> &rhs)
     {
-        for (const int document_id_in : search_server)
+        if (lhs.empty() && rhs.empty())
+        {
+            return 1.0;
+        }
+        size_t common = 0;
+        auto lhs_it = lhs.begin();
+        auto rhs_it = rhs.begin();
+        while (lhs_it != lhs.end() && rhs_it != rhs.end())
         {
-            if (document_id_out != document_id_in)
+            if (lhs_it->term_id < rhs_it->term_id)
             {
-                if (key_compare(search_server.GetWordFrequencies(document_id_out), search_server.GetWordFrequencies(document_id_in)))
-                {
-                    if (document_id_out > document_id_in)
-                    {
-                        deleted_documents.insert(document_id_out);
-                    }
-                    else if (document_id_out < document_id_in)
-                    {
-                        deleted_documents.insert(document_id_in);
-                    }
-                }
+                ++lhs_it;
+            }
+            else if (rhs_it->term_id < lhs_it->term_id)
+            {
+                ++rhs_it;
+            }
+            else
+            {
+                ++common;
+                ++lhs_it;
+                ++rhs_it;
             }
         }
+        return common * 1.0 / (lhs.size() + rhs.size() - common);
     }
-    for (const int deleted_id : deleted_documents)
+
+    // Term frequencies of the documents in ascending id order.
+    std::vector<std::pair<int, const std::vector<TermFrequency> *>> GetDocuments(const SearchServer &search_server)
     {
-        search_server.RemoveDocument(deleted_id);
-        std::cout << "Found duplicate document id " << deleted_id << std::endl;
+        std::vector<std::pair<int, const std::vector<TermFrequency> *>> documents;
+        for (const int document_id : search_server)
+        {
+            documents.emplace_back(document_id, &search_server.GetTermFrequencies(document_id));
+        }
+        return documents;
+    }
+
+    void RemoveDocuments(SearchServer &search_server, const std::vector<int> &document_ids)
+    {
+        for (const int document_id : document_ids)
+        {
+            search_server.RemoveDocument(document_id);
+        }
+    }
+}
+
+// Signatures are computed in parallel; the documents are then visited in
+// ascending id order, so the first document of every group is kept.
+std::vector<int> RemoveDuplicates(SearchServer &search_server)
+{
+    const auto documents = GetDocuments(search_server);
+    std::vector<uint64_t> fingerprints(documents.size());
+    std::transform(std::execution::par, documents.begin(), documents.end(), fingerprints.begin(), [](const auto &document) {
+        return ComputeFingerprint(*document.second);
+    });
+
+    std::unordered_map<uint64_t, std::vector<size_t>> fingerprint_to_kept;
+    std::vector<int> deleted_documents;
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        std::vector<size_t> &kept = fingerprint_to_kept[fingerprints[i]];
+        const bool is_duplicate = std::any_of(kept.begin(), kept.end(), [&](size_t j) {
+            return HaveSameTerms(*documents[i].second, *documents[j].second);
+        });
+        if (is_duplicate)
+        {
+            deleted_documents.push_back(documents[i].first);
+        }
+        else
+        {
+            kept.push_back(i);
+        }
+    }
+    RemoveDocuments(search_server, deleted_documents);
+    return deleted_documents;
+}
+
+// Documents sharing all rows of at least one MinHash band are candidates;
+// their similarity is then computed exactly.
+std::vector<int> RemoveNearDuplicates(SearchServer &search_server, double min_similarity)
+{
+    const auto documents = GetDocuments(search_server);
+    std::vector<std::vector<uint64_t>> signatures(documents.size());
+    std::transform(std::execution::par, documents.begin(), documents.end(), signatures.begin(), [](const auto &document) {
+        return ComputeMinHash(*document.second);
+    });
+
+    std::vector<std::unordered_map<uint64_t, std::vector<size_t>>> bands(MINHASH_BAND_COUNT);
+    std::vector<uint64_t> band_keys(MINHASH_BAND_COUNT);
+    std::vector<int> deleted_documents;
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        bool is_duplicate = false;
+        for (int band = 0; band < MINHASH_BAND_COUNT && !is_duplicate; ++band)
+        {
+            uint64_t band_key = band;
+            for (int row = 0; row < MINHASH_BAND_ROWS; ++row)
+            {
+                band_key = MixHash(band_key ^ signatures[i][band * MINHASH_BAND_ROWS + row]);
+            }
+            band_keys[band] = band_key;
+            const auto it = bands[band].find(band_key);
+            if (it != bands[band].end())
+            {
+                is_duplicate = std::any_of(it->second.begin(), it->second.end(), [&](size_t j) {
+                    return ComputeSimilarity(*documents[i].second, *documents[j].second) >= min_similarity;
+                });
+            }
+        }
+        if (is_duplicate)
+        {
+            deleted_documents.push_back(documents[i].first);
+            continue;
+        }
+        for (int band = 0; band < MINHASH_BAND_COUNT; ++band)
+        {
+            bands[band][band_keys[band]].push_back(i);
+        }
     }
+    RemoveDocuments(search_server, deleted_documents);
+    return deleted_documents;
 }
\ No newline at end of file
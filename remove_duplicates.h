@@ -1,14 +1,15 @@
 #pragma once
 
-#include "search_server.h"
+#include <vector>
 
-template <typename Map>
-bool key_compare(Map const &lhs, Map const &rhs);
+#include "search_server.h"
 
-void RemoveDuplicates(SearchServer &search_server);
+// Removes every document whose set of words equals that of a document with
+// a lower id. Returns the removed ids in ascending order.
+std::vector<int> RemoveDuplicates(SearchServer &search_server);
 
-template <typename Map>
-bool key_compare(Map const &lhs, Map const &rhs)
-{
-    return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](auto a, auto b) { return a.first == b.first; });
-}
\ No newline at end of file
+// Removes every document whose word set has a Jaccard similarity of at
+// least min_similarity with a kept document of lower id. Candidates are
+// found through MinHash signatures, so a pair just above the threshold may
+// be missed. Returns the removed ids in ascending order.
+std::vector<int> RemoveNearDuplicates(SearchServer &search_server, double min_similarity);
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+ResultCache::ResultCache(size_t capacity)
+    : shard_capacity_(std::max<size_t>((capacity + RESULT_CACHE_SHARD_COUNT - 1) / RESULT_CACHE_SHARD_COUNT, 1)), shards_(RESULT_CACHE_SHARD_COUNT)
+{
+}
+
+size_t ResultCache::KeyHash::operator()(const ResultCacheKey &key) const
+{
+    size_t hash = std::hash<std::string>{}(key.words);
+    hash = hash * 31 + static_cast<size_t>(key.status);
+    return hash * 31 + key.max_result_count;
+}
+
+ResultCache::Shard &ResultCache::GetShard(const ResultCacheKey &key)
+{
+    return shards_[KeyHash{}(key) % shards_.size()];
+}
+
+bool ResultCache::Find(const ResultCacheKey &key, uint64_t generation, std::vector<Document> &documents)
+{
+    Shard &shard = GetShard(key);
+    std::lock_guard lock(shard.mutex);
+    const auto it = shard.key_to_entry.find(key);
+    if (it == shard.key_to_entry.end())
+    {
+        ++misses_;
+        return false;
+    }
+    if (it->second->generation != generation)
+    {
+        // A query running on an older version must not drop a newer entry.
+        if (it->second->generation < generation)
+        {
+            shard.entries.erase(it->second);
+            shard.key_to_entry.erase(it);
+            ++invalidations_;
+        }
+        ++misses_;
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    documents = it->second->documents;
+    ++hits_;
+    return true;
+}
+
+void ResultCache::Insert(const ResultCacheKey &key, uint64_t generation, const std::vector<Document> &documents)
+{
+    Shard &shard = GetShard(key);
+    std::lock_guard lock(shard.mutex);
+    const auto it = shard.key_to_entry.find(key);
+    if (it != shard.key_to_entry.end())
+    {
+        if (it->second->generation > generation)
+        {
+            return;
+        }
+        it->second->generation = generation;
+        it->second->documents = documents;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+    shard.entries.push_front({key, generation, documents});
+    shard.key_to_entry.emplace(key, shard.entries.begin());
+    if (shard.entries.size() > shard_capacity_)
+    {
+        shard.key_to_entry.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+        ++evictions_;
+    }
+}
+
+ResultCacheStats ResultCache::GetStats() const
+{
+    return {hits_.load(), misses_.load(), evictions_.load(), invalidations_.load()};
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+static const size_t RESULT_CACHE_SHARD_COUNT = 16;
+
+// Normalized query: plus words and minus words, each sorted, with the
+// filter and the number of results asked for.
+struct ResultCacheKey
+{
+    std::string words;
+    DocumentStatus status;
+    size_t max_result_count;
+
+    bool operator==(const ResultCacheKey &other) const = default;
+};
+
+struct ResultCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    // Entries found but dropped because the index changed after them.
+    uint64_t invalidations = 0;
+};
+
+// Query results tagged with the index generation they were computed at.
+// Keys are spread over shards with an LRU list and a mutex each, so only
+// queries hashing to the same shard contend.
+class ResultCache
+{
+public:
+    explicit ResultCache(size_t capacity);
+
+    // Returns false if there is no entry for key computed at generation.
+    bool Find(const ResultCacheKey &key, uint64_t generation, std::vector<Document> &documents);
+
+    void Insert(const ResultCacheKey &key, uint64_t generation, const std::vector<Document> &documents);
+
+    ResultCacheStats GetStats() const;
+
+private:
+    struct Entry
+    {
+        ResultCacheKey key;
+        uint64_t generation;
+        std::vector<Document> documents;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const ResultCacheKey &key) const;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        // Most recently used first.
+        std::list<Entry> entries;
+        std::unordered_map<ResultCacheKey, std::list<Entry>::iterator, KeyHash> key_to_entry;
+    };
+
+    size_t shard_capacity_;
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> hits_ = 0;
+    std::atomic<uint64_t> misses_ = 0;
+    std::atomic<uint64_t> evictions_ = 0;
+    std::atomic<uint64_t> invalidations_ = 0;
+
+    Shard &GetShard(const ResultCacheKey &key);
+};
\ No newline at end of file
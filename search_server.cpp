@@ -1,10 +1,58 @@
 #include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_set>
 
 #include "search_server.h"
 #include "log_duration.h"
 
 using namespace std::string_literals;
 
+void CorpusStatistics::Merge(const CorpusStatistics &other)
+{
+    document_count += other.document_count;
+    word_count += other.word_count;
+    auto it = word_document_counts.begin();
+    for (const auto &[word, count] : other.word_document_counts)
+    {
+        it = std::lower_bound(it, word_document_counts.end(), word, [](const std::pair<std::string_view, uint32_t> &entry, std::string_view word) {
+            return entry.first < word;
+        });
+        if (it != word_document_counts.end() && it->first == word)
+        {
+            it->second += count;
+        }
+        else
+        {
+            it = word_document_counts.emplace(it, word, count);
+        }
+    }
+}
+
+uint32_t CorpusStatistics::WordDocumentCount(std::string_view word) const
+{
+    auto it = std::lower_bound(word_document_counts.begin(), word_document_counts.end(), word, [](const std::pair<std::string_view, uint32_t> &entry, std::string_view word) {
+        return entry.first < word;
+    });
+    return it == word_document_counts.end() || it->first != word ? 0 : it->second;
+}
+
+size_t DocumentMatches::Size() const
+{
+    return document_ids.size();
+}
+
+std::vector<std::string_view> DocumentMatches::MatchedWords(size_t i) const
+{
+    std::vector<std::string_view> matched_words;
+    matched_words.reserve(offsets[i + 1] - offsets[i]);
+    for (uint32_t k = offsets[i]; k < offsets[i + 1]; ++k)
+    {
+        matched_words.push_back(words[word_indexes[k]]);
+    }
+    return matched_words;
+}
+
 SearchServer::SearchServer(const std::string &stop_words_text)
     : SearchServer(SplitIntoWords(stop_words_text))
 {
@@ -15,26 +63,392 @@ SearchServer::SearchServer(const std::string_view &stop_words_text)
 {
 }
 
+SearchServer::SearchServer(std::shared_ptr<const IndexSnapshot> snapshot)
+    : SearchServer(SplitIntoWords(std::string_view(snapshot->Section<char>(SnapshotSection::STOP_WORDS).data(),
+                                                   snapshot->Section<char>(SnapshotSection::STOP_WORDS).size())))
+{
+    snapshot_ = std::move(snapshot);
+    positions_enabled_ = !snapshot_->Section<uint64_t>(SnapshotSection::TOKEN_OFFSETS).empty();
+    auto version = std::make_shared<IndexVersion>();
+    version->segments.push_back(PublishSegment(std::make_shared<const IndexSegment>(*snapshot_), 0));
+    version->end_ordinal = version->segments.front().EndOrdinal();
+    version->document_count = version->end_ordinal;
+    const std::span<const uint32_t> word_counts = snapshot_->Section<uint32_t>(SnapshotSection::WORD_COUNTS);
+    version->word_count = std::accumulate(word_counts.begin(), word_counts.end(), uint64_t(0));
+    version_.store(std::move(version));
+}
+
+SearchServer SearchServer::LoadSnapshot(const std::string &path)
+{
+    return SearchServer(std::make_shared<const IndexSnapshot>(path));
+}
+
+void SearchServer::SaveSnapshot(const std::string &path) const
+{
+    // Live documents are renumbered densely in ordinal order, which keeps
+    // every posting list sorted.
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    const uint32_t removed = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> new_ordinals(version->end_ordinal, removed);
+    std::vector<int> document_ids;
+    std::vector<int> ratings;
+    std::vector<DocumentStatus> statuses;
+    std::vector<uint32_t> word_counts;
+    for (const PublishedSegment &published : version->segments)
+    {
+        const IndexSegment &segment = *published.segment;
+        for (uint32_t ordinal = 0; ordinal < segment.Size(); ++ordinal)
+        {
+            if (published.IsRemoved(ordinal))
+            {
+                continue;
+            }
+            new_ordinals[published.first_ordinal + ordinal] = document_ids.size();
+            document_ids.push_back(segment.DocumentId(ordinal));
+            ratings.push_back(segment.Rating(ordinal));
+            statuses.push_back(segment.Status(ordinal));
+            word_counts.push_back(segment.WordCount(ordinal));
+        }
+    }
+    std::vector<SnapshotDocument> documents;
+    for (uint32_t ordinal = 0; ordinal < document_ids.size(); ++ordinal)
+    {
+        documents.push_back({document_ids[ordinal], ordinal});
+    }
+    std::sort(documents.begin(), documents.end(), [](const SnapshotDocument &lhs, const SnapshotDocument &rhs) {
+        return lhs.id < rhs.id;
+    });
+
+    std::vector<std::string_view> segment_words;
+    for (const PublishedSegment &published : version->segments)
+    {
+        published.segment->Postings().ForEachTerm([&](std::string_view word, const PostingListView &postings) {
+            segment_words.push_back(word);
+        });
+    }
+    std::sort(segment_words.begin(), segment_words.end());
+    segment_words.erase(std::unique(segment_words.begin(), segment_words.end()), segment_words.end());
+    std::vector<MappedTerm> terms;
+    std::unordered_map<std::string_view, uint32_t> word_to_term_index;
+    std::string words;
+    std::vector<PostingBlockHeader> blocks;
+    std::pmr::vector<uint32_t> block_data;
+    for (const std::string_view word : segment_words)
+    {
+        std::vector<Posting> renumbered;
+        for (const PublishedSegment &published : version->segments)
+        {
+            published.segment->Find(word).ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                const uint32_t new_ordinal = new_ordinals[published.first_ordinal + ordinal];
+                if (new_ordinal != removed)
+                {
+                    renumbered.push_back({new_ordinal, term_count});
+                }
+            });
+        }
+        if (renumbered.empty())
+        {
+            continue;
+        }
+        MappedTerm term{words.size(), static_cast<uint32_t>(word.size()), static_cast<uint32_t>(renumbered.size()), blocks.size(), 0};
+        for (size_t i = 0; i < renumbered.size(); i += POSTING_BLOCK_SIZE)
+        {
+            blocks.push_back(EncodePostingBlock(renumbered.data() + i, std::min(POSTING_BLOCK_SIZE, renumbered.size() - i), block_data));
+        }
+        term.block_count = blocks.size() - term.first_block;
+        word_to_term_index.emplace(word, terms.size());
+        terms.push_back(term);
+        words += word;
+    }
+
+    // Tokens of a snapshot index its dictionary. Without positions there
+    // are none, and the snapshot keeps the format of version 1.
+    std::vector<uint64_t> token_offsets;
+    std::vector<uint8_t> tokens;
+    std::vector<uint32_t> document_tokens;
+    if (positions_enabled_)
+    {
+        token_offsets.push_back(0);
+        for (const PublishedSegment &published : version->segments)
+        {
+            const IndexSegment &segment = *published.segment;
+            for (uint32_t ordinal = 0; ordinal < segment.Size(); ++ordinal)
+            {
+                if (published.IsRemoved(ordinal))
+                {
+                    continue;
+                }
+                segment.DecodeTokens(ordinal, document_tokens);
+                for (const uint32_t token : document_tokens)
+                {
+                    uint8_t bytes[VARINT_MAX_BYTES];
+                    const size_t size = EncodeToken(token == STOP_WORD_TOKEN ? token : word_to_term_index.at(segment.Postings().Word(token)), bytes);
+                    tokens.insert(tokens.end(), bytes, bytes + size);
+                }
+                token_offsets.push_back(tokens.size());
+            }
+        }
+    }
+
+    std::string stop_words;
+    for (const std::string &stop_word : stop_words_)
+    {
+        stop_words += stop_words.empty() ? stop_word : " "s + stop_word;
+    }
+
+    SnapshotWriter writer;
+    writer.SetSection<char>(SnapshotSection::STOP_WORDS, stop_words);
+    writer.SetSection<MappedTerm>(SnapshotSection::TERMS, terms);
+    writer.SetSection<char>(SnapshotSection::WORDS, words);
+    writer.SetSection<PostingBlockHeader>(SnapshotSection::BLOCKS, blocks);
+    writer.SetSection<uint32_t>(SnapshotSection::BLOCK_DATA, block_data);
+    writer.SetSection<int>(SnapshotSection::DOCUMENT_IDS, document_ids);
+    writer.SetSection<int>(SnapshotSection::RATINGS, ratings);
+    writer.SetSection<DocumentStatus>(SnapshotSection::STATUSES, statuses);
+    writer.SetSection<uint32_t>(SnapshotSection::WORD_COUNTS, word_counts);
+    writer.SetSection<SnapshotDocument>(SnapshotSection::DOCUMENTS, documents);
+    writer.SetSection<uint64_t>(SnapshotSection::TOKEN_OFFSETS, token_offsets);
+    writer.SetSection<uint8_t>(SnapshotSection::TOKENS, tokens);
+    writer.Write(path);
+}
+
+// The document is appended to the write buffer, whose view in the new
+// version replaces the one in the last, removals included.
 void SearchServer::AddDocument(int document_id, const std::string_view &document, DocumentStatus status, const std::vector<int> &ratings)
 {
-    if ((document_id < 0) || (documents_.count(document_id) > 0))
+    std::lock_guard lock(writer_mutex_);
+    BuildSnapshotIndexes();
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    if ((document_id < 0) || (FindDocument(*version, document_id).published != nullptr))
     {
         throw std::invalid_argument("Invalid document_id"s);
     }
-    const auto words = SplitIntoWordsNoStop(document);
+    std::vector<uint32_t> positions;
+    const auto words = SplitIntoWordsNoStopView(document, positions_enabled_ ? &positions : nullptr);
 
-    const double inv_word_count = 1.0 / words.size();
-    for (const std::string &word : words)
+    std::vector<uint32_t> term_ids;
+    std::vector<std::string_view> stored_words;
+    term_ids.reserve(words.size());
+    stored_words.reserve(words.size());
+    for (const std::string_view word : words)
     {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
+        term_ids.push_back(term_dictionary_.Intern(word));
+        stored_words.push_back(term_dictionary_.Word(term_ids.back()));
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
+    document_to_term_freqs_.emplace(document_id, ComputeTermFrequencies(std::move(term_ids)));
     document_ids_.insert(document_id);
+
+    auto new_version = std::make_shared<IndexVersion>(*version);
+    const size_t buffered_word_count = positions.empty() ? words.size() : positions.back() + 1;
+    const bool appended = write_buffer_ && write_buffer_->Fits(buffered_word_count);
+    if (!appended)
+    {
+        write_buffer_ = std::make_shared<WriteBuffer>(std::max(WRITE_BUFFER_WORD_COUNT, buffered_word_count), positions_enabled_);
+    }
+    write_buffer_->AppendDocument(document_id, status, ComputeAverageRating(ratings), stored_words, positions);
+    PublishedSegment published = PublishSegment(std::make_shared<const IndexSegment>(write_buffer_), version->end_ordinal);
+    if (appended)
+    {
+        PublishedSegment &previous = new_version->segments.back();
+        published.first_ordinal = previous.first_ordinal;
+        auto tombstones = std::make_shared<Bitmap>(*previous.tombstones);
+        tombstones->Resize(published.segment->Size());
+        published.tombstones = std::move(tombstones);
+        published.pending_removals = previous.pending_removals;
+        published.removed_word_counts = previous.removed_word_counts;
+        previous = std::move(published);
+    }
+    else
+    {
+        new_version->segments.push_back(std::move(published));
+    }
+    if (write_buffer_->Size() == WRITE_BUFFER_DOCUMENT_COUNT)
+    {
+        write_buffer_.reset();
+    }
+    new_version->buffered = write_buffer_ != nullptr;
+    ++new_version->end_ordinal;
+    ++new_version->document_count;
+    new_version->word_count += words.size();
+    ++new_version->generation;
+    Publish(std::move(new_version));
+}
+
+void SearchServer::AddDocuments(const std::vector<DocumentInput> &documents)
+{
+    IndexDocuments(std::execution::seq, documents);
+}
+
+void SearchServer::AddDocuments(const std::execution::sequenced_policy &, const std::vector<DocumentInput> &documents)
+{
+    IndexDocuments(std::execution::seq, documents);
+}
+
+void SearchServer::AddDocuments(const std::execution::parallel_policy &, const std::vector<DocumentInput> &documents)
+{
+    IndexDocuments(std::execution::par, documents);
+}
+
+void SearchServer::AddDocuments(const PoolExecutionPolicy &execution_policy, const std::vector<DocumentInput> &documents)
+{
+    IndexDocuments(execution_policy, documents);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::IndexDocuments(const ExecutionPolicy &execution_policy, const std::vector<DocumentInput> &documents)
+{
+    if (documents.empty())
+    {
+        return;
+    }
+
+    // Tokenize everything first; errors are reported afterwards in batch
+    // order, so the first rejected document wins as with AddDocument.
+    struct TokenizedDocument
+    {
+        std::vector<std::string_view> words;
+        std::vector<uint32_t> positions;
+        std::string error;
+    };
+    std::vector<TokenizedDocument> tokenized_documents(documents.size());
+    ParallelFor(execution_policy, documents.size(), [&](size_t i) {
+        try
+        {
+            tokenized_documents[i].words = SplitIntoWordsNoStopView(documents[i].text, positions_enabled_ ? &tokenized_documents[i].positions : nullptr);
+        }
+        catch (const std::invalid_argument &e)
+        {
+            tokenized_documents[i].error = e.what();
+        }
+    });
+
+    // Every chunk of consecutive documents builds its own partial index,
+    // with ordinals relative to the start of the batch.
+    using PartialIndex = std::unordered_map<std::string_view, std::vector<Posting>>;
+    const size_t chunk_count = std::max<size_t>(std::min<size_t>(ParallelTaskCount(execution_policy), documents.size()), 1);
+    const size_t chunk_size = (documents.size() + chunk_count - 1) / chunk_count;
+    std::vector<PartialIndex> partial_indexes(chunk_count);
+    ParallelFor(execution_policy, chunk_count, [&](size_t chunk) {
+        PartialIndex &partial_index = partial_indexes[chunk];
+        for (size_t i = chunk * chunk_size; i < std::min(documents.size(), (chunk + 1) * chunk_size); ++i)
+        {
+            const uint32_t ordinal = i;
+            for (const std::string_view word : tokenized_documents[i].words)
+            {
+                std::vector<Posting> &postings = partial_index[word];
+                if (!postings.empty() && postings.back().document_ordinal == ordinal)
+                {
+                    ++postings.back().term_count;
+                }
+                else
+                {
+                    postings.push_back({ordinal, 1});
+                }
+            }
+        }
+    });
+
+    // Writers are locked out only once the batch is ready to be merged in.
+    std::lock_guard lock(writer_mutex_);
+    BuildSnapshotIndexes();
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    std::unordered_set<int> batch_ids;
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        const int document_id = documents[i].id;
+        if ((document_id < 0) || (FindDocument(*version, document_id).published != nullptr) || !batch_ids.insert(document_id).second)
+        {
+            throw std::invalid_argument("Invalid document_id"s);
+        }
+        if (!tokenized_documents[i].error.empty())
+        {
+            throw std::invalid_argument(tokenized_documents[i].error);
+        }
+    }
+
+    // Dictionary entries are created sequentially, then the posting lists
+    // append the chunks in ordinal order, one term per task.
+    auto segment = std::make_shared<IndexSegment>(NewSegmentMemory(), positions_enabled_);
+    struct TermMerge
+    {
+        uint32_t term_id;
+        uint32_t term_index;
+        PostingList *postings;
+        std::vector<const std::vector<Posting> *> parts;
+    };
+    std::unordered_map<std::string_view, size_t> word_to_merge;
+    std::vector<TermMerge> merges;
+    for (const PartialIndex &partial_index : partial_indexes)
+    {
+        for (const auto &[word, postings] : partial_index)
+        {
+            const auto [it, inserted] = word_to_merge.emplace(word, merges.size());
+            if (inserted)
+            {
+                const uint32_t term_id = term_dictionary_.Intern(word);
+                IndexedTerm &term = segment->Postings().Insert(term_dictionary_.Word(term_id));
+                merges.push_back({term_id, term.index, &term.postings, {}});
+            }
+            merges[it->second].parts.push_back(&postings);
+        }
+    }
+    ParallelFor(execution_policy, merges.size(), [&merges](size_t merge_index) {
+        const TermMerge &merge = merges[merge_index];
+        for (const std::vector<Posting> *part : merge.parts)
+        {
+            for (const Posting &posting : *part)
+            {
+                merge.postings->Add(posting.document_ordinal, posting.term_count);
+            }
+        }
+    });
+
+    std::vector<std::vector<TermFrequency>> documents_term_freqs(documents.size());
+    std::vector<std::vector<uint32_t>> documents_tokens(documents.size());
+    ParallelFor(execution_policy, documents.size(), [&](size_t i) {
+        const TokenizedDocument &tokenized_document = tokenized_documents[i];
+        std::vector<uint32_t> term_ids;
+        term_ids.reserve(tokenized_document.words.size());
+        documents_tokens[i].reserve(tokenized_document.positions.empty() ? 0 : tokenized_document.positions.back() + 1);
+        for (size_t j = 0; j < tokenized_document.words.size(); ++j)
+        {
+            const TermMerge &merge = merges[word_to_merge.at(tokenized_document.words[j])];
+            term_ids.push_back(merge.term_id);
+            if (positions_enabled_)
+            {
+                documents_tokens[i].resize(tokenized_document.positions[j], STOP_WORD_TOKEN);
+                documents_tokens[i].push_back(merge.term_index);
+            }
+        }
+        documents_term_freqs[i] = ComputeTermFrequencies(std::move(term_ids));
+    });
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        const DocumentInput &document = documents[i];
+        document_to_term_freqs_.emplace(document.id, std::move(documents_term_freqs[i]));
+        segment->AppendDocument(document.id, document.status, ComputeAverageRating(document.ratings), tokenized_documents[i].words.size(), documents_tokens[i]);
+        document_ids_.insert(document.id);
+    }
+    segment->IndexDocumentIds();
+
+    // The batch follows the write buffer, which is closed.
+    write_buffer_.reset();
+    auto new_version = std::make_shared<IndexVersion>(*version);
+    new_version->segments.push_back(PublishSegment(std::move(segment), version->end_ordinal));
+    new_version->buffered = false;
+    new_version->end_ordinal = version->end_ordinal + documents.size();
+    new_version->document_count += documents.size();
+    for (const TokenizedDocument &tokenized_document : tokenized_documents)
+    {
+        new_version->word_count += tokenized_document.words.size();
+    }
+    ++new_version->generation;
+    Publish(std::move(new_version));
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentStatus status) const
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentStatus status, size_t max_result_count) const
 {
-    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, status);
+    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, status, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query) const
@@ -42,11 +456,41 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw
     return SearchServer::FindTopDocuments(std::execution::seq, raw_query);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy &, const std::string_view &raw_query, DocumentStatus status) const
+CorpusStatistics SearchServer::GetCorpusStatistics(const std::string_view &raw_query) const
+{
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    CorpusStatistics statistics;
+    statistics.document_count = version->document_count;
+    statistics.word_count = version->word_count;
+    statistics.word_document_counts.reserve(query.plus_words.Size());
+    for (const std::string_view &word : query.plus_words)
+    {
+        statistics.word_document_counts.emplace_back(word, LookUpTerm(*version, word).document_count);
+    }
+    return statistics;
+}
+
+std::vector<Document> SearchServer::FindTopDocumentsPruned(const std::string_view &raw_query, DocumentStatus status, size_t max_result_count) const
 {
-    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+    return FindTopDocumentsPruned(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
         return document_status == status;
-    });
+    }, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocumentsByProximity(const std::string_view &raw_query, DocumentStatus status, size_t max_result_count) const
+{
+    return FindTopDocumentsByProximity(
+        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        },
+        max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy &, const std::string_view &raw_query, DocumentStatus status,
+                                                     size_t max_result_count) const
+{
+    return FindTopDocumentsWithStatus(std::execution::seq, raw_query, status, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy &, const std::string_view &raw_query) const
@@ -54,11 +498,10 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::seque
     return SearchServer::FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy &, const std::string_view &raw_query, DocumentStatus status) const
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy &, const std::string_view &raw_query, DocumentStatus status,
+                                                     size_t max_result_count) const
 {
-    return SearchServer::FindTopDocuments(std::execution::par, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+    return FindTopDocumentsWithStatus(std::execution::par, raw_query, status, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy &, const std::string_view &raw_query) const
@@ -66,18 +509,166 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::paral
     return SearchServer::FindTopDocuments(std::execution::par, raw_query, DocumentStatus::ACTUAL);
 }
 
+std::vector<Document> SearchServer::FindTopDocuments(const PoolExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentStatus status,
+                                                     size_t max_result_count) const
+{
+    return FindTopDocumentsWithStatus(execution_policy, raw_query, status, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const PoolExecutionPolicy &execution_policy, const std::string_view &raw_query) const
+{
+    return SearchServer::FindTopDocuments(execution_policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+std::vector<SearchServer::BatchTerm> SearchServer::PlanQueryBatch(const IndexVersion &version, const TfIdfRanking &ranking, const std::vector<std::string> &raw_queries,
+                                                                   std::vector<size_t> &phrase_queries) const
+{
+    std::unordered_map<std::string_view, size_t> word_to_term;
+    std::vector<BatchTerm> terms;
+    const auto find_term = [&](std::string_view word) -> BatchTerm & {
+        const auto [it, inserted] = word_to_term.emplace(word, terms.size());
+        if (inserted)
+        {
+            terms.push_back({word});
+        }
+        return terms[it->second];
+    };
+    for (size_t i = 0; i < raw_queries.size(); ++i)
+    {
+        const Query query = ParseQuery(raw_queries[i]);
+        if (!query.phrases.empty())
+        {
+            phrase_queries.push_back(i);
+            continue;
+        }
+        for (const std::string_view &word : query.plus_words)
+        {
+            find_term(word).plus_queries.push_back(i);
+        }
+        for (const std::string_view &word : query.minus_words)
+        {
+            find_term(word).minus_queries.push_back(i);
+        }
+    }
+
+    for (BatchTerm &term : terms)
+    {
+        TermPostings term_postings = LookUpTerm(version, term.word);
+        if (term_postings.document_count == 0)
+        {
+            continue;
+        }
+        term.word_weight = ranking.WordWeight(term_postings.document_count);
+        term.postings.assign(term_postings.postings.begin(), term_postings.postings.end());
+    }
+    std::erase_if(terms, [](const BatchTerm &term) {
+        return term.postings.empty();
+    });
+    std::sort(terms.begin(), terms.end(), [](const BatchTerm &lhs, const BatchTerm &rhs) {
+        return lhs.word < rhs.word;
+    });
+    return terms;
+}
+
+std::span<const size_t> SearchServer::QueriesInWindow(const std::vector<size_t> &queries, size_t first_query, size_t last_query)
+{
+    const auto first = std::lower_bound(queries.begin(), queries.end(), first_query);
+    const auto last = std::lower_bound(first, queries.end(), last_query);
+    return std::span<const size_t>(first, last);
+}
+
+void SearchServer::EnableResultCache(size_t capacity)
+{
+    result_cache_ = std::make_unique<ResultCache>(capacity);
+}
+
+void SearchServer::EnableArenas()
+{
+    arenas_enabled_ = true;
+}
+
+void SearchServer::EnablePositions()
+{
+    positions_enabled_ = true;
+}
+
+SegmentMemory SearchServer::NewSegmentMemory() const
+{
+    return arenas_enabled_ ? SegmentMemory::ARENA : SegmentMemory::HEAP;
+}
+
+std::pmr::memory_resource *SearchServer::QueryMemoryResource() const
+{
+    if (!arenas_enabled_)
+    {
+        return std::pmr::get_default_resource();
+    }
+    static thread_local std::pmr::unsynchronized_pool_resource pool;
+    return &pool;
+}
+
+ResultCacheStats SearchServer::GetResultCacheStats() const
+{
+    return result_cache_ ? result_cache_->GetStats() : ResultCacheStats{};
+}
+
+// Words cannot contain control characters, so a newline separates the
+// plus words from the minus words.
+ResultCacheKey SearchServer::MakeResultCacheKey(const Query &query, DocumentStatus status, size_t max_result_count)
+{
+    ResultCacheKey key{{}, status, max_result_count};
+    for (const std::string_view &word : query.plus_words)
+    {
+        key.words += word;
+        key.words += ' ';
+    }
+    key.words += '\n';
+    for (const std::string_view &word : query.minus_words)
+    {
+        key.words += word;
+        key.words += ' ';
+    }
+    for (const std::vector<std::string_view> &phrase : query.phrases)
+    {
+        key.words += '\n';
+        for (const std::string_view &word : phrase)
+        {
+            key.words += word;
+            key.words += ' ';
+        }
+    }
+    return key;
+}
+
 int SearchServer::GetDocumentCount() const
 {
-    return documents_.size();
+    return version_.load()->document_count;
+}
+
+bool SearchServer::ContainsDocument(int document_id) const
+{
+    return FindDocument(*version_.load(), document_id).published != nullptr;
+}
+
+void SearchServer::CheckDocumentWords(std::string_view document)
+{
+    ForEachWordView(document, [](std::string_view word) {
+        if (!IsValidWord(word))
+        {
+            throw std::invalid_argument("Word "s + std::string(word) + " is invalid"s);
+        }
+    });
 }
 
 std::set<int>::const_iterator SearchServer::begin() const
 {
+    BuildSnapshotIndexes();
     return document_ids_.begin();
 }
 
 std::set<int>::const_iterator SearchServer::end() const
 {
+    BuildSnapshotIndexes();
     return document_ids_.end();
 }
 
@@ -88,61 +679,227 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy &, std::string_view raw_query, int document_id) const
 {
-    std::vector<std::string_view> vec_query = SplitIntoWordsView(raw_query);
-    const Query query = SearchServer::ParseQuery(vec_query);
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    const DocumentLocation document = GetDocument(*version, document_id);
+    const IndexSegment &segment = *document.published->segment;
+    const uint32_t ordinal = document.ordinal;
     std::vector<std::string_view> matched_words;
-    for (const std::string_view &word : query.plus_words)
+    for (const std::string_view &word : query.minus_words)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        if (segment.Find(word).Contains(ordinal))
         {
-            continue;
+            return {matched_words, segment.Status(ordinal)};
         }
-        if (word_to_document_freqs_.find(word)->second.count(document_id))
+    }
+    if (!ContainsPhrases(segment, ordinal, query))
+    {
+        return {matched_words, segment.Status(ordinal)};
+    }
+    matched_words.reserve(query.plus_words.Size());
+    for (const std::string_view &word : query.plus_words)
+    {
+        if (segment.Find(word).Contains(ordinal))
         {
             matched_words.push_back(word);
         }
     }
+    return {std::move(matched_words), segment.Status(ordinal)};
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy &, std::string_view raw_query, int document_id) const
+{
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    const DocumentLocation document = GetDocument(*version, document_id);
+    const IndexSegment &segment = *document.published->segment;
+    const uint32_t ordinal = document.ordinal;
+    // Sized up front: parallel copy_if needs a forward output iterator.
+    std::vector<std::string_view> matched_words(query.plus_words.Size());
+    matched_words.erase(std::copy_if(std::execution::par, query.plus_words.begin(), query.plus_words.end(), matched_words.begin(),
+                                     [&](const std::string_view &word) {
+                                         return segment.Find(word).Contains(ordinal);
+                                     }),
+                        matched_words.end());
+    if (std::any_of(std::execution::par, query.minus_words.begin(), query.minus_words.end(),
+                    [&](const std::string_view &word) {
+                        return segment.Find(word).Contains(ordinal);
+                    }) ||
+        !ContainsPhrases(segment, ordinal, query))
+    {
+        matched_words.clear();
+    }
+    return {std::move(matched_words), segment.Status(ordinal)};
+}
+
+DocumentMatches SearchServer::MatchAllDocuments(const std::string_view &raw_query) const
+{
+    return MatchAllDocuments(std::execution::seq, raw_query);
+}
+
+DocumentMatches SearchServer::MatchAllDocuments(const std::execution::sequenced_policy &, std::string_view raw_query) const
+{
+    return CollectMatches(std::execution::seq, raw_query);
+}
+
+DocumentMatches SearchServer::MatchAllDocuments(const std::execution::parallel_policy &, std::string_view raw_query) const
+{
+    return CollectMatches(std::execution::par, raw_query);
+}
+
+DocumentMatches SearchServer::MatchAllDocuments(const PoolExecutionPolicy &execution_policy, std::string_view raw_query) const
+{
+    return CollectMatches(execution_policy, raw_query);
+}
+
+// Each chunk of ordinals walks the part of every plus posting list that
+// falls into it, word by word, and sorts what it found by ordinal; chunks
+// write disjoint ordinals. The matches are then laid out by document id.
+template <typename ExecutionPolicy>
+DocumentMatches SearchServer::CollectMatches(const ExecutionPolicy &execution_policy, std::string_view raw_query) const
+{
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    Bitmap excluded(version->end_ordinal);
     for (const std::string_view &word : query.minus_words)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        for (const auto &[published, postings] : LookUpTerm(*version, word).postings)
         {
-            continue;
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                excluded.Set(published->first_ordinal + ordinal);
+            });
+        }
+    }
+    if (!query.phrases.empty())
+    {
+        Bitmap phrase_matches = MatchPhrases(*version, query);
+        phrase_matches.Flip();
+        excluded.Or(phrase_matches);
+    }
+    std::vector<TermPostings> plus_terms;
+    plus_terms.reserve(query.plus_words.Size());
+    for (const std::string_view &word : query.plus_words)
+    {
+        plus_terms.push_back(LookUpTerm(*version, word));
+    }
+
+    // Pairs of an ordinal and the index of a word it contains.
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> chunk_matches((version->end_ordinal + MATCH_CHUNK_ORDINAL_COUNT - 1) / MATCH_CHUNK_ORDINAL_COUNT);
+    std::vector<uint32_t> match_counts(version->end_ordinal);
+    ParallelFor(execution_policy, chunk_matches.size(), [&](size_t chunk_index) {
+        const uint32_t chunk_begin = chunk_index * MATCH_CHUNK_ORDINAL_COUNT;
+        const uint32_t chunk_end = std::min<uint32_t>(chunk_begin + MATCH_CHUNK_ORDINAL_COUNT, version->end_ordinal);
+        std::vector<std::pair<uint32_t, uint32_t>> &matches = chunk_matches[chunk_index];
+        for (uint32_t word_index = 0; word_index < plus_terms.size(); ++word_index)
+        {
+            for (const auto &[published, postings] : plus_terms[word_index].postings)
+            {
+                const uint32_t first_ordinal = published->first_ordinal;
+                if (published->EndOrdinal() <= chunk_begin || first_ordinal >= chunk_end)
+                {
+                    continue;
+                }
+                PostingCursor cursor(postings);
+                for (cursor.SkipTo(std::max(chunk_begin, first_ordinal) - first_ordinal); !cursor.AtEnd() && first_ordinal + cursor.Ordinal() < chunk_end; cursor.Next())
+                {
+                    const uint32_t ordinal = first_ordinal + cursor.Ordinal();
+                    if (!excluded.Test(ordinal))
+                    {
+                        matches.emplace_back(ordinal, word_index);
+                        ++match_counts[ordinal];
+                    }
+                }
+            }
+        }
+        std::stable_sort(matches.begin(), matches.end(), [](const std::pair<uint32_t, uint32_t> &lhs, const std::pair<uint32_t, uint32_t> &rhs) {
+            return lhs.first < rhs.first;
+        });
+    });
+
+    // Where the words of each ordinal start among the matches of all chunks.
+    std::vector<uint32_t> match_begins(version->end_ordinal);
+    std::exclusive_scan(match_counts.begin(), match_counts.end(), match_begins.begin(), uint32_t(0));
+    std::vector<uint32_t> chunk_word_indexes(match_begins.empty() ? 0 : match_begins.back() + match_counts.back());
+    ParallelFor(execution_policy, chunk_matches.size(), [&](size_t chunk_index) {
+        const std::vector<std::pair<uint32_t, uint32_t>> &matches = chunk_matches[chunk_index];
+        if (!matches.empty())
+        {
+            std::transform(matches.begin(), matches.end(), chunk_word_indexes.begin() + match_begins[matches.front().first],
+                           [](const std::pair<uint32_t, uint32_t> &match) {
+                               return match.second;
+                           });
         }
-        if (word_to_document_freqs_.find(word)->second.count(document_id))
+    });
+
+    // Ids are unique, so the order does not depend on the rest.
+    std::vector<std::tuple<int, uint32_t, DocumentStatus>> documents;
+    documents.reserve(version->document_count);
+    for (const PublishedSegment &published : version->segments)
+    {
+        const IndexSegment &segment = *published.segment;
+        for (uint32_t ordinal = 0; ordinal < segment.Size(); ++ordinal)
         {
-            matched_words.clear();
-            break;
+            if (!published.IsRemoved(ordinal))
+            {
+                documents.emplace_back(segment.DocumentId(ordinal), published.first_ordinal + ordinal, segment.Status(ordinal));
+            }
         }
     }
-    return {matched_words, documents_.at(document_id).status};
-}
+    if constexpr (std::is_execution_policy_v<ExecutionPolicy>)
+    {
+        std::sort(execution_policy, documents.begin(), documents.end());
+    }
+    else
+    {
+        std::sort(documents.begin(), documents.end());
+    }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy &, std::string_view raw_query, int document_id) const
-{
-    std::vector<std::string_view> vec_query = SplitIntoWordsView(raw_query);
-    const Query query = SearchServer::ParseQuery(vec_query);
-    std::vector<std::string_view> matched_words;
-    std::copy_if(std::execution::par, query.plus_words.begin(), query.plus_words.end(), back_inserter(matched_words),
-                 [&](const std::string_view &word) { return (word_to_document_freqs_.count(word) == 0) ? false : (word_to_document_freqs_.find(word)->second.count(document_id)); });
-    if (std::any_of(std::execution::par, query.minus_words.begin(), query.minus_words.end(),
-                    [&](const std::string_view &word) { return (word_to_document_freqs_.count(word) == 0) ? false : (word_to_document_freqs_.find(word)->second.count(document_id)); }))
+    DocumentMatches result;
+    result.words.assign(query.plus_words.begin(), query.plus_words.end());
+    result.document_ids.resize(documents.size());
+    result.statuses.resize(documents.size());
+    result.offsets.resize(documents.size() + 1);
+    for (size_t i = 0; i < documents.size(); ++i)
     {
-        matched_words.clear();
+        result.offsets[i + 1] = result.offsets[i] + match_counts[std::get<1>(documents[i])];
     }
-    return {matched_words, documents_.at(document_id).status};
+    result.word_indexes.resize(result.offsets.back());
+    ParallelFor(execution_policy, documents.size(), [&](size_t i) {
+        const auto [document_id, ordinal, status] = documents[i];
+        result.document_ids[i] = document_id;
+        result.statuses[i] = status;
+        std::copy_n(chunk_word_indexes.begin() + match_begins[ordinal], match_counts[ordinal], result.word_indexes.begin() + result.offsets[i]);
+    });
+    return result;
 }
 
-const std::map<std::string_view, double> SearchServer::GetWordFrequencies(int document_id)
+const std::map<std::string_view, double> &SearchServer::GetWordFrequencies(int document_id) const
 {
-    std::map<std::string_view, double> word_frequencies;
-    for (const auto &[word, id_freq] : word_to_document_freqs_)
+    static const std::map<std::string_view, double> empty_word_frequencies;
+    BuildSnapshotIndexes();
+    const auto it = document_to_term_freqs_.find(document_id);
+    if (it == document_to_term_freqs_.end())
+    {
+        return empty_word_frequencies;
+    }
+    std::lock_guard lock(word_freqs_mutex_);
+    const auto [word_freqs_it, inserted] = document_to_word_freqs_.try_emplace(document_id);
+    if (inserted)
     {
-        if (id_freq.count(document_id))
+        for (const TermFrequency &term_freq : it->second)
         {
-            word_frequencies.emplace(word, id_freq.at(document_id));
+            word_freqs_it->second.emplace(term_dictionary_.Word(term_freq.term_id), term_freq.freq);
         }
     }
-    return word_frequencies;
+    return word_freqs_it->second;
+}
+
+const std::vector<TermFrequency> &SearchServer::GetTermFrequencies(int document_id) const
+{
+    static const std::vector<TermFrequency> empty_term_frequencies;
+    BuildSnapshotIndexes();
+    const auto it = document_to_term_freqs_.find(document_id);
+    return it == document_to_term_freqs_.end() ? empty_term_frequencies : it->second;
 }
 
 void SearchServer::RemoveDocument(int document_id)
@@ -150,24 +907,239 @@ void SearchServer::RemoveDocument(int document_id)
     RemoveDocument(std::execution::seq, document_id);
 }
 
+// The postings stay in place behind a tombstone until their segment is
+// merged; the new version only replaces the tombstones of that segment.
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy &, int document_id)
 {
-    for (const auto &[word, id_freq] : word_to_document_freqs_)
+    std::lock_guard lock(writer_mutex_);
+    BuildSnapshotIndexes();
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    const DocumentLocation document = FindDocument(*version, document_id);
+    if (document.published == nullptr)
     {
-        if (id_freq.count(document_id))
-        {
-            word_to_document_freqs_.at(word).erase(document_id);
-        }
+        return;
+    }
+    auto new_version = std::make_shared<IndexVersion>(*version);
+    PublishedSegment &published = new_version->segments[document.published - version->segments.data()];
+    auto tombstones = std::make_shared<Bitmap>(*published.tombstones);
+    tombstones->Set(document.ordinal);
+    published.tombstones = std::move(tombstones);
+    ++published.pending_removals;
+    std::vector<std::string_view> words;
+    for (const TermFrequency &term_freq : document_to_term_freqs_.at(document_id))
+    {
+        words.push_back(term_dictionary_.Word(term_freq.term_id));
+    }
+    static const RemovedWordCounts no_removed_words;
+    published.removed_word_counts = (published.removed_word_counts ? *published.removed_word_counts : no_removed_words).WithRemoved(words);
+    --new_version->document_count;
+    new_version->word_count -= published.segment->WordCount(document.ordinal);
+    ++new_version->generation;
+    Publish(std::move(new_version));
+    document_to_term_freqs_.erase(document_id);
+    {
+        std::lock_guard word_freqs_lock(word_freqs_mutex_);
+        document_to_word_freqs_.erase(document_id);
     }
-    documents_.erase(document_id);
     document_ids_.erase(document_id);
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy &, int document_id)
 {
-    std::for_each(std::execution::par, word_to_document_freqs_.begin(), word_to_document_freqs_.end(), [&](const auto &word_id_freqs) { word_to_document_freqs_.at(word_id_freqs.first).erase(document_id); });
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
+    RemoveDocument(std::execution::seq, document_id);
+}
+
+// The document id set and the forward index of a loaded snapshot are built
+// on first use; queries do not need them. Writers build them before their
+// first modification, while the snapshot is still the only segment.
+void SearchServer::BuildSnapshotIndexes() const
+{
+    if (!snapshot_)
+    {
+        return;
+    }
+    std::call_once(snapshot_indexes_built_, [this]() {
+        const IndexSegment &segment = *version_.load()->segments.front().segment;
+        for (uint32_t ordinal = 0; ordinal < segment.Size(); ++ordinal)
+        {
+            document_ids_.insert(segment.DocumentId(ordinal));
+            document_to_term_freqs_[segment.DocumentId(ordinal)];
+        }
+        // The dictionary is still empty, so term ids grow with every term
+        // and each forward index entry stays sorted.
+        segment.Postings().ForEachTerm([&](std::string_view word, const PostingListView &postings) {
+            const uint32_t term_id = term_dictionary_.Intern(word);
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                document_to_term_freqs_[segment.DocumentId(ordinal)].push_back({term_id, term_count * 1.0 / segment.WordCount(ordinal)});
+            });
+        });
+    });
+}
+
+SearchServer::DocumentLocation SearchServer::FindDocument(const IndexVersion &version, int document_id)
+{
+    for (const PublishedSegment &published : version.segments)
+    {
+        for (const SnapshotDocument &document : published.segment->FindDocuments(document_id))
+        {
+            if (!published.IsRemoved(document.ordinal))
+            {
+                return {&published, document.ordinal};
+            }
+        }
+    }
+    return {nullptr, 0};
+}
+
+SearchServer::DocumentLocation SearchServer::GetDocument(const IndexVersion &version, int document_id)
+{
+    const DocumentLocation document = FindDocument(version, document_id);
+    if (document.published == nullptr)
+    {
+        throw std::out_of_range("Invalid document_id"s);
+    }
+    return document;
+}
+
+// Occurrences are added one by one, so the frequency of a word does not
+// depend on how its document was indexed.
+std::vector<TermFrequency> SearchServer::ComputeTermFrequencies(std::vector<uint32_t> term_ids)
+{
+    const double inv_word_count = 1.0 / term_ids.size();
+    std::sort(term_ids.begin(), term_ids.end());
+    std::vector<TermFrequency> term_freqs;
+    for (const uint32_t term_id : term_ids)
+    {
+        if (term_freqs.empty() || term_freqs.back().term_id != term_id)
+        {
+            term_freqs.push_back({term_id, 0.0});
+        }
+        term_freqs.back().freq += inv_word_count;
+    }
+    return term_freqs;
+}
+
+SearchServer::TermPostings SearchServer::LookUpTerm(const IndexVersion &version, std::string_view word, std::pmr::memory_resource *memory_resource)
+{
+    TermPostings term{0, std::pmr::vector<std::pair<const PublishedSegment *, PostingListView>>(memory_resource)};
+    for (const PublishedSegment &published : version.segments)
+    {
+        const PostingListView postings = published.segment->Find(word);
+        if (!postings.Empty())
+        {
+            term.document_count += published.CountLiveDocuments(word, postings);
+            term.postings.emplace_back(&published, postings);
+        }
+    }
+    return term;
+}
+
+// Runs the merges that are cheap enough for the writer, then makes the
+// version visible to new queries.
+void SearchServer::Publish(std::shared_ptr<IndexVersion> version)
+{
+    for (size_t first = FindMergeableSegments(*version, false); first != version->segments.size(); first = FindMergeableSegments(*version, false))
+    {
+        const std::span<const PublishedSegment> merged_segments(version->segments.data() + first, SEGMENT_MERGE_FACTOR);
+        ReplaceSegments(*version, first, merged_segments, MergeSegments(merged_segments));
+    }
+    const bool background_merge = FindMergeableSegments(*version, true) != version->segments.size();
+    version_.store(std::move(version));
+    if (background_merge)
+    {
+        merge_needed_.notify_one();
+    }
+}
+
+// Returns the first of SEGMENT_MERGE_FACTOR adjacent segments of one level
+// whose merge is left to the merger (background) or to the writer, or
+// version.segments.size() if there are none. The view of an open write
+// buffer is never merged.
+size_t SearchServer::FindMergeableSegments(const IndexVersion &version, bool background)
+{
+    const std::vector<PublishedSegment> &segments = version.segments;
+    const size_t merged_end = version.buffered ? segments.size() - 1 : segments.size();
+    size_t run_begin = 0;
+    for (size_t i = 0; i < merged_end; ++i)
+    {
+        if (segments[i].segment->Level() != segments[run_begin].segment->Level())
+        {
+            run_begin = i;
+        }
+        if (i + 1 - run_begin == SEGMENT_MERGE_FACTOR)
+        {
+            const uint32_t merged_size = segments[i].EndOrdinal() - segments[run_begin].first_ordinal;
+            if ((merged_size >= SEGMENT_FOREGROUND_MERGE_LIMIT) == background)
+            {
+                return run_begin;
+            }
+            ++run_begin;
+        }
+    }
+    return segments.size();
+}
+
+// Swaps the merge of merged_segments into version, where the same
+// segments start at first. Removals published while the merge was running
+// stay pending. The segments after the merge move down by the removed
+// documents it left out.
+void SearchServer::ReplaceSegments(IndexVersion &version, size_t first, std::span<const PublishedSegment> merged_segments,
+                                   std::shared_ptr<const IndexSegment> merged)
+{
+    const std::span<const PublishedSegment> replaced(version.segments.data() + first, merged_segments.size());
+    PublishedSegment published{std::move(merged), replaced.front().first_ordinal, MergeTombstones(merged_segments, replaced), 0, nullptr};
+    for (size_t i = 0; i < replaced.size(); ++i)
+    {
+        published.pending_removals += replaced[i].pending_removals - merged_segments[i].pending_removals;
+    }
+    if (published.pending_removals > 0)
+    {
+        published.removed_word_counts = CountRemovedWords(*published.segment, *published.tombstones);
+    }
+    const auto replaced_begin = version.segments.begin() + first;
+    if (published.segment->Size() == 0)
+    {
+        version.segments.erase(replaced_begin, replaced_begin + replaced.size());
+    }
+    else
+    {
+        version.segments.erase(replaced_begin + 1, replaced_begin + replaced.size());
+        version.segments[first] = std::move(published);
+    }
+    for (size_t i = first; i < version.segments.size(); ++i)
+    {
+        version.segments[i].first_ordinal = i == 0 ? 0 : version.segments[i - 1].EndOrdinal();
+    }
+    version.end_ordinal = version.segments.empty() ? 0 : version.segments.back().EndOrdinal();
+}
+
+// Runs on merger_. Published segments are immutable, so they are merged
+// without holding writer_mutex_.
+void SearchServer::RunMerger(std::stop_token stop_token)
+{
+    std::unique_lock lock(writer_mutex_);
+    const auto merge_needed = [this]() {
+        const std::shared_ptr<const IndexVersion> version = version_.load();
+        return FindMergeableSegments(*version, true) != version->segments.size();
+    };
+    while (merge_needed_.wait(lock, stop_token, merge_needed) && !stop_token.stop_requested())
+    {
+        const std::shared_ptr<const IndexVersion> version = version_.load();
+        const size_t first = FindMergeableSegments(*version, true);
+        const std::span<const PublishedSegment> merged_segments(version->segments.data() + first, SEGMENT_MERGE_FACTOR);
+        lock.unlock();
+        std::shared_ptr<const IndexSegment> merged = MergeSegments(merged_segments);
+        lock.lock();
+
+        // Writers may have appended segments or replaced tombstones in the
+        // meantime, and their own merges may have moved the merged run.
+        auto new_version = std::make_shared<IndexVersion>(*version_.load());
+        const auto it = std::find_if(new_version->segments.begin(), new_version->segments.end(), [&](const PublishedSegment &published) {
+            return published.segment == merged_segments.front().segment;
+        });
+        ReplaceSegments(*new_version, it - new_version->segments.begin(), merged_segments, std::move(merged));
+        version_.store(std::move(new_version));
+    }
 }
 
 bool SearchServer::IsStopWord(const std::string_view &word) const
@@ -182,20 +1154,29 @@ bool SearchServer::IsValidWord(const std::string_view &word)
     });
 }
 
-std::vector<std::string> SearchServer::SplitIntoWordsNoStop(const std::string_view &text) const
+std::vector<std::string_view> SearchServer::SplitIntoWordsNoStopView(std::string_view text, std::vector<uint32_t> *positions) const
 {
-    std::vector<std::string> words;
-    for (const std::string &word : SplitIntoWords(text))
-    {
+    std::vector<std::string_view> words;
+    uint32_t position = 0;
+    ForEachWordView(text, [&](std::string_view word) {
+        if (word.empty())
+        {
+            return;
+        }
         if (!IsValidWord(word))
         {
-            throw std::invalid_argument("Word "s + word + " is invalid"s);
+            throw std::invalid_argument("Word "s + std::string(word) + " is invalid"s);
         }
         if (!IsStopWord(word))
         {
-            words.push_back(std::move(word));
+            words.push_back(word);
+            if (positions != nullptr)
+            {
+                positions->push_back(position);
+            }
         }
-    }
+        ++position;
+    });
     return words;
 }
 
@@ -226,7 +1207,7 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(const std::string_view &tex
         is_minus = true;
         word = word.substr(1);
     }
-    if (word.empty() || word[0] == '-' || !IsValidWord(word))
+    if (word.empty() || word[0] == '-' || word.find('"') != std::string_view::npos || !IsValidWord(word))
     {
         std::string txt{text};
         throw std::invalid_argument("Query word "s + txt + " is invalid");
@@ -235,30 +1216,265 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(const std::string_view &tex
     return {word, is_minus, IsStopWord(word)};
 }
 
-SearchServer::Query SearchServer::ParseQuery(const std::vector<std::string_view> &query) const
+// A phrase opens with a word starting with a quote and closes with a word
+// ending with one; quotes elsewhere are invalid. Stop words at either end
+// of a phrase are dropped.
+SearchServer::Query SearchServer::ParseQuery(std::string_view raw_query) const
 {
     Query result;
-    for (const std::string_view &word : query)
-    {
+    bool in_phrase = false;
+    std::vector<std::string_view> phrase;
+    ForEachWordView(raw_query, [&](std::string_view word) {
+        if (!in_phrase && !word.empty() && word.front() == '"')
+        {
+            in_phrase = true;
+            word.remove_prefix(1);
+        }
+        const bool closes_phrase = in_phrase && !word.empty() && word.back() == '"';
+        if (closes_phrase)
+        {
+            word.remove_suffix(1);
+        }
         const auto query_word = ParseQueryWord(word);
+        if (in_phrase && query_word.is_minus)
+        {
+            throw std::invalid_argument("Phrase word -"s + std::string(query_word.data) + " is invalid"s);
+        }
         if (!query_word.is_stop)
         {
             if (query_word.is_minus)
             {
-                result.minus_words.insert(std::move(query_word.data));
+                result.minus_words.PushBack(query_word.data);
             }
             else
             {
-                result.plus_words.insert(std::move(query_word.data));
+                result.plus_words.PushBack(query_word.data);
+            }
+            if (in_phrase)
+            {
+                phrase.push_back(query_word.data);
             }
         }
+        else if (in_phrase && !phrase.empty())
+        {
+            phrase.emplace_back();
+        }
+        if (closes_phrase)
+        {
+            while (!phrase.empty() && phrase.back().empty())
+            {
+                phrase.pop_back();
+            }
+            if (std::count_if(phrase.begin(), phrase.end(), [](std::string_view phrase_word) {
+                    return !phrase_word.empty();
+                }) > 1)
+            {
+                if (!positions_enabled_)
+                {
+                    throw std::invalid_argument("Phrase queries need word positions"s);
+                }
+                result.phrases.push_back(std::move(phrase));
+            }
+            phrase.clear();
+            in_phrase = false;
+        }
+    });
+    if (in_phrase)
+    {
+        throw std::invalid_argument("Query phrase is not closed"s);
+    }
+    for (auto *words : {&result.plus_words, &result.minus_words})
+    {
+        std::sort(words->begin(), words->end());
+        words->Truncate(std::unique(words->begin(), words->end()) - words->begin());
     }
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const std::string_view &word) const
+bool SearchServer::IsMoreRelevant(const Document &lhs, const Document &rhs)
+{
+    if (std::abs(lhs.relevance - rhs.relevance) < RELEVANCE_TOLERANCE)
+    {
+        return lhs.rating > rhs.rating;
+    }
+    else
+    {
+        return lhs.relevance > rhs.relevance;
+    }
+}
+
+void SearchServer::SelectTopDocuments(const std::execution::sequenced_policy &, std::vector<Document> &documents, size_t max_result_count)
+{
+    const size_t result_count = std::min(max_result_count, documents.size());
+    std::partial_sort(documents.begin(), documents.begin() + result_count, documents.end(), IsMoreRelevant);
+    documents.resize(result_count);
+}
+
+void SearchServer::SelectTopDocuments(const std::execution::parallel_policy &, std::vector<Document> &documents, size_t max_result_count)
 {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.find(word)->second.size());
+    SelectTopDocumentsInChunks(std::execution::par, documents, max_result_count, NUMBER_PARALLEL_PROCESSES);
+}
+
+void SearchServer::SelectTopDocuments(const PoolExecutionPolicy &execution_policy, std::vector<Document> &documents, size_t max_result_count)
+{
+    SelectTopDocumentsInChunks(execution_policy, documents, max_result_count, execution_policy.pool->ThreadCount());
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::SelectTopDocumentsInChunks(const ExecutionPolicy &execution_policy, std::vector<Document> &documents, size_t max_result_count, size_t chunk_count)
+{
+    if (documents.size() <= max_result_count * chunk_count)
+    {
+        SelectTopDocuments(std::execution::seq, documents, max_result_count);
+        return;
+    }
+    // Every chunk moves its own top max_result_count to its front, then the
+    // winners of all chunks compete for the final result.
+    const size_t chunk_size = (documents.size() + chunk_count - 1) / chunk_count;
+    std::vector<size_t> chunk_begins(chunk_count);
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        chunk_begins[i] = std::min(i * chunk_size, documents.size());
+    }
+    ParallelFor(execution_policy, chunk_count, [&](size_t chunk) {
+        const size_t chunk_begin = chunk_begins[chunk];
+        const auto first = documents.begin() + chunk_begin;
+        const auto last = documents.begin() + std::min(chunk_begin + chunk_size, documents.size());
+        std::partial_sort(first, first + std::min<size_t>(max_result_count, last - first), last, IsMoreRelevant);
+    });
+    std::vector<Document> candidates;
+    candidates.reserve(max_result_count * chunk_count);
+    for (const size_t chunk_begin : chunk_begins)
+    {
+        const size_t chunk_end = std::min(chunk_begin + chunk_size, documents.size());
+        const size_t winners = std::min(max_result_count, chunk_end - chunk_begin);
+        candidates.insert(candidates.end(), documents.begin() + chunk_begin, documents.begin() + chunk_begin + winners);
+    }
+    SelectTopDocuments(std::execution::seq, candidates, max_result_count);
+    documents = std::move(candidates);
+}
+
+void SearchServer::PushTopDocument(std::vector<Document> &top_documents, const Document &document, size_t max_result_count)
+{
+    if (top_documents.size() < max_result_count)
+    {
+        top_documents.push_back(document);
+        std::push_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+    }
+    else if (max_result_count > 0 && IsMoreRelevant(document, top_documents.front()))
+    {
+        std::pop_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        top_documents.back() = document;
+        std::push_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+    }
+}
+
+// Segments contribute their status bitmaps and tombstones a word at a
+// time; ratings are scanned only when the range is bounded, and listed ids
+// are looked up one by one.
+Bitmap SearchServer::RejectDocuments(const IndexVersion &version, const DocumentFilter &filter)
+{
+    const bool rating_bounded = filter.min_rating != std::numeric_limits<int>::min() || filter.max_rating != std::numeric_limits<int>::max();
+    Bitmap admitted(version.end_ordinal);
+    for (const PublishedSegment &published : version.segments)
+    {
+        const IndexSegment &segment = *published.segment;
+        Bitmap segment_admitted(segment.Size());
+        for (const DocumentStatus status : filter.statuses)
+        {
+            segment_admitted.Or(segment.StatusDocuments(status));
+        }
+        if (rating_bounded)
+        {
+            segment_admitted.And(segment.RatingDocuments(filter.min_rating, filter.max_rating));
+        }
+        segment_admitted.AndNot(*published.tombstones);
+        admitted.Or(segment_admitted, published.first_ordinal);
+    }
+    if (filter.allowed_ids)
+    {
+        Bitmap allowed(version.end_ordinal);
+        for (const int document_id : *filter.allowed_ids)
+        {
+            const DocumentLocation document = FindDocument(version, document_id);
+            if (document.published != nullptr)
+            {
+                allowed.Set(document.published->first_ordinal + document.ordinal);
+            }
+        }
+        admitted.And(allowed);
+    }
+    for (const int document_id : filter.denied_ids)
+    {
+        const DocumentLocation document = FindDocument(version, document_id);
+        if (document.published != nullptr)
+        {
+            admitted.Reset(document.published->first_ordinal + document.ordinal);
+        }
+    }
+    admitted.Flip();
+    return admitted;
+}
+
+Bitmap SearchServer::MatchPhrases(const IndexVersion &version, const Query &query)
+{
+    Bitmap matches(version.end_ordinal);
+    std::vector<uint32_t> common_ordinals;
+    for (const PublishedSegment &published : version.segments)
+    {
+        std::vector<uint32_t> ordinals = published.segment->FindPhrase(query.phrases.front());
+        for (size_t i = 1; i < query.phrases.size() && !ordinals.empty(); ++i)
+        {
+            const std::vector<uint32_t> phrase_ordinals = published.segment->FindPhrase(query.phrases[i]);
+            common_ordinals.clear();
+            std::set_intersection(ordinals.begin(), ordinals.end(), phrase_ordinals.begin(), phrase_ordinals.end(), std::back_inserter(common_ordinals));
+            ordinals.swap(common_ordinals);
+        }
+        for (const uint32_t ordinal : ordinals)
+        {
+            matches.Set(published.first_ordinal + ordinal);
+        }
+    }
+    return matches;
+}
+
+bool SearchServer::ContainsPhrases(const IndexSegment &segment, uint32_t ordinal, const Query &query)
+{
+    return std::all_of(query.phrases.begin(), query.phrases.end(), [&](const std::vector<std::string_view> &phrase) {
+        return segment.ContainsPhrase(phrase, ordinal);
+    });
+}
+
+uint32_t SearchServer::ComputePlusWordDistance(const IndexVersion &version, const Query &query, int document_id)
+{
+    const DocumentLocation document = FindDocument(version, document_id);
+    if (document.published == nullptr)
+    {
+        return 0;
+    }
+    const IndexSegment &segment = *document.published->segment;
+    // Positions of all the plus words, each tagged with its word.
+    std::vector<std::vector<uint32_t>> positions;
+    segment.DecodePositions(document.ordinal, std::span<const std::string_view>(query.plus_words.begin(), query.plus_words.end()), positions);
+    std::vector<std::pair<uint32_t, size_t>> word_positions;
+    for (size_t word_index = 0; word_index < positions.size(); ++word_index)
+    {
+        for (const uint32_t position : positions[word_index])
+        {
+            word_positions.emplace_back(position, word_index);
+        }
+    }
+    std::sort(word_positions.begin(), word_positions.end());
+    uint32_t distance = 0;
+    for (size_t i = 1; i < word_positions.size(); ++i)
+    {
+        if (word_positions[i].second != word_positions[i - 1].second)
+        {
+            const uint32_t gap = word_positions[i].first - word_positions[i - 1].first;
+            distance = distance == 0 ? gap : std::min(distance, gap);
+        }
+    }
+    return distance;
 }
 
 void PrintMatchDocumentResult(int document_id, const std::vector<std::string_view> &words, DocumentStatus status)
@@ -310,10 +1526,10 @@ void MatchDocuments(const SearchServer &search_server, const std::string_view &q
     try
     {
         std::cout << "Матчинг документов по запросу: "s << query << std::endl;
-        for (const int document_id : search_server)
+        const DocumentMatches matches = search_server.MatchAllDocuments(query);
+        for (size_t i = 0; i < matches.Size(); ++i)
         {
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
+            PrintMatchDocumentResult(matches.document_ids[i], matches.MatchedWords(i), matches.statuses[i]);
         }
     }
     catch (const std::invalid_argument &e)
@@ -1,10 +1,32 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
 #include <execution>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <stop_token>
+#include <thread>
+#include <tuple>
 
 #include "string_processing.h"
 #include "document.h"
-#include "concurrent_map.h"
+#include "index_segment.h"
+#include "index_snapshot.h"
+#include "inverted_index.h"
+#include "ranking.h"
+#include "relevance_accumulator.h"
+#include "result_cache.h"
+#include "small_vector.h"
+#include "term_dictionary.h"
+#include "thread_pool.h"
 
 using namespace std::string_literals;
 
@@ -12,14 +34,85 @@ static const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
 static const int NUMBER_PARALLEL_PROCESSES = 4;
 
-enum class DocumentStatus
+// Queries of a batch that are scored together; bounds the number of
+// per-query relevance accumulators alive at once.
+static const size_t BATCH_WINDOW_QUERY_COUNT = 16;
+
+// Relevances closer than this are equal; the rating decides between them.
+static const double RELEVANCE_TOLERANCE = 1e-6;
+
+// Plus or minus words of a query kept in place while parsing; longer
+// queries spill to the heap.
+static const size_t QUERY_INLINE_WORD_COUNT = 128;
+
+// Multiple of the requested result count that proximity ranking reorders.
+static const size_t PROXIMITY_CANDIDATE_FACTOR = 10;
+
+// Ordinals MatchAllDocuments collects the matches of in one task.
+static const uint32_t MATCH_CHUNK_ORDINAL_COUNT = 1 << 16;
+
+struct DocumentInput
 {
-    ACTUAL,
-    IRRELEVANT,
-    BANNED,
-    REMOVED,
+    int id;
+    std::string_view text;
+    DocumentStatus status;
+    std::vector<int> ratings;
 };
 
+// Document metadata filter. FindTopDocuments applies it to whole segments
+// as bitmap operations before scoring instead of testing every posting.
+struct DocumentFilter
+{
+    std::vector<DocumentStatus> statuses = {DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT, DocumentStatus::BANNED, DocumentStatus::REMOVED};
+    int min_rating = std::numeric_limits<int>::min();
+    int max_rating = std::numeric_limits<int>::max();
+    // Only these documents pass if set.
+    std::optional<std::vector<int>> allowed_ids;
+    std::vector<int> denied_ids;
+};
+
+// Document frequencies to weigh the words of a query by, gathered from
+// one server or summed over the servers a corpus is split across.
+struct CorpusStatistics
+{
+    size_t document_count = 0;
+    // Words of the live documents, stop words left out.
+    uint64_t word_count = 0;
+    // Live documents containing each plus word of the query, sorted by
+    // word. The words view the raw query.
+    std::vector<std::pair<std::string_view, uint32_t>> word_document_counts;
+
+    // Adds the counts of the same query gathered from another part of the
+    // corpus.
+    void Merge(const CorpusStatistics &other);
+
+    uint32_t WordDocumentCount(std::string_view word) const;
+};
+
+// Plus words of a query found in every live document, in the layout of a
+// compressed sparse row matrix: document i contains words[word_indexes[k]]
+// for k in [offsets[i], offsets[i + 1]). Documents are ordered by id. The
+// words view the raw query.
+struct DocumentMatches
+{
+    // Plus words of the query, sorted.
+    std::vector<std::string_view> words;
+    std::vector<int> document_ids;
+    std::vector<DocumentStatus> statuses;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> word_indexes;
+
+    size_t Size() const;
+
+    // The words of document i as MatchDocument returns them.
+    std::vector<std::string_view> MatchedWords(size_t i) const;
+};
+
+// Queries may run concurrently with AddDocument, AddDocuments and
+// RemoveDocument and never wait for them: each query works on the index
+// version that was current when it started. Iteration over the document
+// ids and the map returned by GetWordFrequencies are not synchronized with
+// writers.
 class SearchServer
 {
 public:
@@ -32,26 +125,153 @@ public:
 
     void AddDocument(int document_id, const std::string_view &document, DocumentStatus status, const std::vector<int> &ratings);
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentPredicate document_predicate) const;
+    // Adds a batch with the same validation as calling AddDocument for each
+    // document in order, but all or nothing: if a document is rejected, the
+    // exception is thrown before anything is added.
+    void AddDocuments(const std::vector<DocumentInput> &documents);
+
+    void AddDocuments(const std::execution::sequenced_policy &, const std::vector<DocumentInput> &documents);
+
+    void AddDocuments(const std::execution::parallel_policy &, const std::vector<DocumentInput> &documents);
+
+    void AddDocuments(const PoolExecutionPolicy &execution_policy, const std::vector<DocumentInput> &documents);
+
+    // Ranking scores the documents: TfIdfRanking, the default, or
+    // Bm25Ranking from ranking.h. Every overload without an execution
+    // policy runs sequentially.
+    template <typename Ranking = TfIdfRanking, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // The overloads given a Ranking explicitly bypass the result cache,
+    // which holds TF-IDF results only.
+    template <typename Ranking>
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentStatus status) const;
+    template <typename Ranking = TfIdfRanking>
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, const DocumentFilter &filter,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     std::vector<Document> FindTopDocuments(const std::string_view &raw_query) const;
 
-    template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentPredicate document_predicate) const;
+    template <typename Ranking>
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query) const;
+
+    template <typename Ranking = TfIdfRanking, typename ExecutionPolicy, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <typename Ranking, typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <typename Ranking, typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query) const;
 
-    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy &, const std::string_view &raw_query, DocumentStatus status) const;
+    template <typename Ranking = TfIdfRanking, typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, const DocumentFilter &filter,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy &, const std::string_view &raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy &, const std::string_view &raw_query) const;
 
-    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy &, const std::string_view &raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy &, const std::string_view &raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy &, const std::string_view &raw_query) const;
 
+    // Posting blocks are scored on the pool; called from a task of the
+    // same pool, the query shares its threads with the other tasks.
+    std::vector<Document> FindTopDocuments(const PoolExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentStatus status,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const PoolExecutionPolicy &execution_policy, const std::string_view &raw_query) const;
+
+    // The order of the results of FindTopDocuments.
+    static bool IsMoreRelevant(const Document &lhs, const Document &rhs);
+
+    // Ranks like FindTopDocuments, then reorders the best
+    // PROXIMITY_CANDIDATE_FACTOR * max_result_count documents by how close
+    // their plus words are: the relevance of a document is multiplied by
+    // 1 + 1 / distance, the distance being the fewest words from one plus
+    // word to another in it. Needs EnablePositions.
+    template <std::invocable<int, DocumentStatus, int> DocumentPredicate>
+    std::vector<Document> FindTopDocumentsByProximity(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                      size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocumentsByProximity(const std::string_view &raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+                                                      size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Counts the documents of this server that weigh the words of the query.
+    CorpusStatistics GetCorpusStatistics(const std::string_view &raw_query) const;
+
+    // Ranks the documents of this server like FindTopDocuments, but weighs
+    // the words by corpus, gathered with GetCorpusStatistics from this and
+    // other servers. Documents score as if all the servers were one.
+    template <typename Ranking = TfIdfRanking, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const CorpusStatistics &corpus, const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Answers every query like FindTopDocuments with TfIdfRanking, but
+    // looks up and weighs each word once for the whole batch and walks its
+    // postings once per window of BATCH_WINDOW_QUERY_COUNT queries; windows
+    // run in parallel under a parallel policy or on a pool. Calls
+    // handle_result(query_index, std::vector<Document> &&documents) in
+    // query order.
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename ResultHandler>
+    void FindTopDocumentsBatch(const ExecutionPolicy &execution_policy, const std::vector<std::string> &raw_queries, DocumentPredicate document_predicate,
+                               ResultHandler handle_result, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Returns the same documents as FindTopDocuments with TfIdfRanking, but
+    // scores the query document at a time with block-max MaxScore: a
+    // document is skipped unscored when the largest relevance its words can
+    // reach in their posting blocks cannot place it among the
+    // max_result_count best found so far. Pays off for queries mixing rare
+    // and common words with few results asked for, as in natural text,
+    // where it is many times faster; on words of even frequency nothing is
+    // skipped and FindTopDocuments is faster.
+    template <std::invocable<int, DocumentStatus, int> DocumentPredicate>
+    std::vector<Document> FindTopDocumentsPruned(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                 size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocumentsPruned(const std::string_view &raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+                                                 size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Caches up to capacity results of FindTopDocuments called with a
+    // DocumentStatus; queries with a predicate bypass the cache. Must not be
+    // called while queries run.
+    void EnableResultCache(size_t capacity);
+
+    // Builds new segments, merges included, in arenas released with the
+    // segment instead of one heap allocation per container, and takes the
+    // posting lookups of FindTopDocuments from a pool kept by each querying
+    // thread. Must not be called while writers or queries run.
+    void EnableArenas();
+
+    // Keeps the words of each document in order, stop words included, as a
+    // stream of term indexes, which quoted phrases in queries and
+    // FindTopDocumentsByProximity need; without it they throw
+    // std::invalid_argument. A phrase matches where its words follow each
+    // other, its stop words matching any stop word. Must be called before
+    // any document is added.
+    void EnablePositions();
+
+    ResultCacheStats GetResultCacheStats() const;
+
     int GetDocumentCount() const;
 
+    bool ContainsDocument(int document_id) const;
+
+    // Throws std::invalid_argument, as AddDocument would, if a word of the
+    // document is invalid.
+    static void CheckDocumentWords(std::string_view document);
+
     std::set<int>::const_iterator begin() const;
 
     std::set<int>::const_iterator end() const;
@@ -62,7 +282,23 @@ public:
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy &, std::string_view raw_query, int document_id) const;
 
-    const std::map<std::string_view, double> GetWordFrequencies(int document_id);
+    // Matches every live document at once: parses the query once and walks
+    // each posting list once instead of looking up every word in every
+    // document. Under a parallel policy, ranges of
+    // MATCH_CHUNK_ORDINAL_COUNT ordinals are matched in parallel.
+    DocumentMatches MatchAllDocuments(const std::string_view &raw_query) const;
+
+    DocumentMatches MatchAllDocuments(const std::execution::sequenced_policy &, std::string_view raw_query) const;
+
+    DocumentMatches MatchAllDocuments(const std::execution::parallel_policy &, std::string_view raw_query) const;
+
+    DocumentMatches MatchAllDocuments(const PoolExecutionPolicy &execution_policy, std::string_view raw_query) const;
+
+    const std::map<std::string_view, double> &GetWordFrequencies(int document_id) const;
+
+    // Term frequencies of the document ordered by term id. Ids are dense,
+    // assigned by the server to every indexed word, and never reused.
+    const std::vector<TermFrequency> &GetTermFrequencies(int document_id) const;
 
     void RemoveDocument(int document_id);
 
@@ -70,22 +306,121 @@ public:
 
     void RemoveDocument(const std::execution::parallel_policy &, int document_id);
 
+    // Writes stop words, term dictionary, postings and document metadata
+    // in a versioned binary format. Removed documents are left out.
+    void SaveSnapshot(const std::string &path) const;
+
+    // Maps a snapshot file and serves queries from the mapped pages. Data
+    // is copied to the heap only when the server is modified; the document
+    // id set and the forward index are built on first use.
+    static SearchServer LoadSnapshot(const std::string &path);
+
 private:
-    struct DocumentData
+    // Everything a query reads. A version is never modified once it is
+    // published; writers publish a modified copy, and a query keeps the
+    // version it started with alive until it is done.
+    struct IndexVersion
+    {
+        // In ordinal order, covering the ordinals [0, end_ordinal) one after
+        // the other.
+        std::vector<PublishedSegment> segments;
+        uint32_t end_ordinal = 0;
+        size_t document_count = 0;
+        // Words of the live documents, stop words left out; with
+        // document_count, gives the average document length.
+        uint64_t word_count = 0;
+        // Bumped whenever documents are added or removed, not by merges.
+        uint64_t generation = 0;
+        // Whether the last segment views the open write buffer, which is
+        // left out of merges while documents are appended to it.
+        bool buffered = false;
+    };
+
+    // Segment and ordinal within it of a live document; published is null
+    // if there is no such document.
+    struct DocumentLocation
     {
-        int rating;
-        DocumentStatus status;
+        const PublishedSegment *published;
+        uint32_t ordinal;
     };
+
     const std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string, std::map<int, double>, std::less<>> word_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
+    std::atomic<std::shared_ptr<const IndexVersion>> version_;
+    std::unique_ptr<ResultCache> result_cache_;
+    bool arenas_enabled_ = false;
+    bool positions_enabled_ = false;
+
+    // Writers and the merger serialize on writer_mutex_; the members below
+    // are only used by writers.
+    std::mutex writer_mutex_;
+    // Owns the words of the postings and of the forward index. Stored words
+    // never move, so queries read them while writers intern new ones.
+    mutable TermDictionary term_dictionary_;
+    mutable std::map<int, std::vector<TermFrequency>> document_to_term_freqs_;
+    mutable std::set<int> document_ids_;
+    // Buffer AddDocument appends to; null once full or followed by another
+    // segment.
+    std::shared_ptr<WriteBuffer> write_buffer_;
+    // Built by GetWordFrequencies on demand.
+    mutable std::mutex word_freqs_mutex_;
+    mutable std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
+
+    std::shared_ptr<const IndexSnapshot> snapshot_;
+    mutable std::once_flag snapshot_indexes_built_;
+
+    std::condition_variable_any merge_needed_;
+    // Declared last so that it is stopped before the index is destroyed.
+    std::jthread merger_;
+
+    explicit SearchServer(std::shared_ptr<const IndexSnapshot> snapshot);
+
+    void BuildSnapshotIndexes() const;
+
+    static DocumentLocation FindDocument(const IndexVersion &version, int document_id);
+
+    static DocumentLocation GetDocument(const IndexVersion &version, int document_id);
+
+    // Term frequencies of a document given the term ids of its words.
+    static std::vector<TermFrequency> ComputeTermFrequencies(std::vector<uint32_t> term_ids);
+
+    // Postings of a word in every segment, found with one dictionary probe
+    // per segment, and the number of live documents containing the word.
+    struct TermPostings
+    {
+        uint32_t document_count = 0;
+        std::pmr::vector<std::pair<const PublishedSegment *, PostingListView>> postings;
+    };
+
+    static TermPostings LookUpTerm(const IndexVersion &version, std::string_view word,
+                                   std::pmr::memory_resource *memory_resource = std::pmr::get_default_resource());
+
+    SegmentMemory NewSegmentMemory() const;
+
+    // The pool of the calling thread if arenas are enabled, else the heap.
+    std::pmr::memory_resource *QueryMemoryResource() const;
+
+    void Publish(std::shared_ptr<IndexVersion> version);
+
+    static size_t FindMergeableSegments(const IndexVersion &version, bool background);
+
+    static void ReplaceSegments(IndexVersion &version, size_t first, std::span<const PublishedSegment> merged_segments,
+                                std::shared_ptr<const IndexSegment> merged);
+
+    void RunMerger(std::stop_token stop_token);
 
     bool IsStopWord(const std::string_view &word) const;
 
     static bool IsValidWord(const std::string_view &word);
 
-    std::vector<std::string> SplitIntoWordsNoStop(const std::string_view &text) const;
+    // Sets positions, if given, to the places of the words in text, stop
+    // words counted.
+    std::vector<std::string_view> SplitIntoWordsNoStopView(std::string_view text, std::vector<uint32_t> *positions = nullptr) const;
+
+    template <typename ExecutionPolicy>
+    void IndexDocuments(const ExecutionPolicy &execution_policy, const std::vector<DocumentInput> &documents);
+
+    template <typename ExecutionPolicy>
+    DocumentMatches CollectMatches(const ExecutionPolicy &execution_policy, std::string_view raw_query) const;
 
     static int ComputeAverageRating(const std::vector<int> &ratings);
 
@@ -98,18 +433,109 @@ private:
 
     QueryWord ParseQueryWord(const std::string_view &text) const;
 
+    // Words are sorted and unique.
     struct Query
     {
-        std::set<std::string_view, std::less<>> plus_words;
-        std::set<std::string_view, std::less<>> minus_words;
+        SmallVector<std::string_view, QUERY_INLINE_WORD_COUNT> plus_words;
+        SmallVector<std::string_view, QUERY_INLINE_WORD_COUNT> minus_words;
+        // Quoted phrases of two words or more besides stop words, in order.
+        // Stop words inside a phrase are kept as empty words; the others
+        // are plus words too.
+        std::vector<std::vector<std::string_view>> phrases;
     };
 
-    Query ParseQuery(const std::vector<std::string_view> &query) const;
+    Query ParseQuery(std::string_view raw_query) const;
+
+    // Ordinals of the documents containing every phrase of the query.
+    static Bitmap MatchPhrases(const IndexVersion &version, const Query &query);
+
+    static bool ContainsPhrases(const IndexSegment &segment, uint32_t ordinal, const Query &query);
+
+    // Fewest words between two different plus words of the query in the
+    // document; 0 if it contains fewer than two of them.
+    static uint32_t ComputePlusWordDistance(const IndexVersion &version, const Query &query, int document_id);
+
+    // Ordinals of the documents that are removed or that filter rejects.
+    static Bitmap RejectDocuments(const IndexVersion &version, const DocumentFilter &filter);
+
+    // Words are weighed by corpus if given, else by the version. Documents
+    // in rejected are left out before the predicate is called.
+    template <typename Ranking = TfIdfRanking, typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsInVersion(const ExecutionPolicy &execution_policy, const IndexVersion &version, const Query &query,
+                                                    DocumentPredicate document_predicate, size_t max_result_count, const CorpusStatistics *corpus = nullptr,
+                                                    const Bitmap *rejected = nullptr) const;
+
+    template <typename Ranking, typename ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsWithFilter(const ExecutionPolicy &execution_policy, const IndexVersion &version, const Query &query,
+                                                     const DocumentFilter &filter, size_t max_result_count) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsWithStatus(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentStatus status,
+                                                     size_t max_result_count) const;
+
+    static ResultCacheKey MakeResultCacheKey(const Query &query, DocumentStatus status, size_t max_result_count);
+
+    template <typename Ranking, typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(const ExecutionPolicy &execution_policy, const IndexVersion &version, const Query &query, DocumentPredicate document_predicate,
+                                           const CorpusStatistics *corpus = nullptr, const Bitmap *rejected = nullptr) const;
+
+    // A word of a query batch with its postings in every segment.
+    struct BatchTerm
+    {
+        std::string_view word;
+        double word_weight = 0.0;
+        std::vector<std::pair<const PublishedSegment *, PostingListView>> postings;
+        // Ascending indexes of the queries using the word.
+        std::vector<size_t> plus_queries;
+        std::vector<size_t> minus_queries;
+    };
+
+    // Parses the queries and returns their distinct words ordered by word,
+    // which keeps the summation order of FindAllDocuments. Queries with
+    // phrases are left out and listed in phrase_queries in ascending order.
+    std::vector<BatchTerm> PlanQueryBatch(const IndexVersion &version, const TfIdfRanking &ranking, const std::vector<std::string> &raw_queries,
+                                          std::vector<size_t> &phrase_queries) const;
+
+    static std::span<const size_t> QueriesInWindow(const std::vector<size_t> &queries, size_t first_query, size_t last_query);
+
+    template <typename DocumentPredicate>
+    static std::vector<std::vector<Document>> FindTopDocumentsInWindow(const IndexVersion &version, const TfIdfRanking &ranking, const std::vector<BatchTerm> &terms,
+                                                                       size_t first_query, size_t last_query, DocumentPredicate document_predicate,
+                                                                       size_t max_result_count);
+
+    // A plus word of a query with its postings in one segment.
+    struct BoundedTerm
+    {
+        PostingCursor cursor;
+        std::span<const TermFreq> max_term_freqs;
+        double word_weight;
+        // Largest relevance the word adds to a document of the segment.
+        double max_relevance;
+    };
+
+    // terms are ordered by word, which keeps the summation order of
+    // FindAllDocuments.
+    template <typename DocumentPredicate>
+    static void FindTopDocumentsInSegment(const PublishedSegment &published, const TfIdfRanking &ranking, std::vector<BoundedTerm> &terms, const Bitmap &excluded,
+                                          DocumentPredicate document_predicate, size_t max_result_count, std::vector<Document> &top_documents);
+
+    static void SelectTopDocuments(const std::execution::sequenced_policy &, std::vector<Document> &documents, size_t max_result_count);
 
-    double ComputeWordInverseDocumentFreq(const std::string_view &word) const;
+    static void SelectTopDocuments(const std::execution::parallel_policy &, std::vector<Document> &documents, size_t max_result_count);
 
-    template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const ExecutionPolicy &execution_policy, const Query &query, DocumentPredicate document_predicate) const;
+    static void SelectTopDocuments(const PoolExecutionPolicy &execution_policy, std::vector<Document> &documents, size_t max_result_count);
+
+    template <typename ExecutionPolicy>
+    static void SelectTopDocumentsInChunks(const ExecutionPolicy &execution_policy, std::vector<Document> &documents, size_t max_result_count, size_t chunk_count);
+
+    // Tasks a parallel step is split into: one per thread of a pool, else
+    // NUMBER_PARALLEL_PROCESSES.
+    template <typename ExecutionPolicy>
+    static size_t ParallelTaskCount(const ExecutionPolicy &execution_policy);
+
+    // Keeps the max_result_count most relevant documents pushed so far in a
+    // heap whose front is the least relevant of them.
+    static void PushTopDocument(std::vector<Document> &top_documents, const Document &document, size_t max_result_count);
 };
 
 void PrintMatchDocumentResult(int document_id, const std::vector<std::string_view> &words, DocumentStatus status);
@@ -129,72 +555,557 @@ SearchServer::SearchServer(const StringContainer &stop_words)
     {
         throw std::invalid_argument("Some of stop words are invalid"s);
     }
+    version_.store(std::make_shared<const IndexVersion>());
+    merger_ = std::jthread([this](std::stop_token stop_token) {
+        RunMerger(stop_token);
+    });
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentPredicate document_predicate) const
+template <typename Ranking, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_result_count) const
+{
+    return SearchServer::FindTopDocuments<Ranking>(std::execution::seq, raw_query, document_predicate, max_result_count);
+}
+
+template <typename Ranking>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentStatus status, size_t max_result_count) const
+{
+    return SearchServer::FindTopDocuments<Ranking>(std::execution::seq, raw_query, status, max_result_count);
+}
+
+template <typename Ranking>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query, const DocumentFilter &filter, size_t max_result_count) const
+{
+    return SearchServer::FindTopDocuments<Ranking>(std::execution::seq, raw_query, filter, max_result_count);
+}
+
+template <typename Ranking>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view &raw_query) const
+{
+    return SearchServer::FindTopDocuments<Ranking>(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename Ranking, typename ExecutionPolicy, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_result_count) const
+{
+    const Query query = ParseQuery(raw_query);
+    return FindTopDocumentsInVersion<Ranking>(execution_policy, *version_.load(), query, document_predicate, max_result_count);
+}
+
+template <typename Ranking, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentStatus status,
+                                                     size_t max_result_count) const
+{
+    DocumentFilter filter;
+    filter.statuses = {status};
+    return SearchServer::FindTopDocuments<Ranking>(execution_policy, raw_query, filter, max_result_count);
+}
+
+template <typename Ranking, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query) const
+{
+    return SearchServer::FindTopDocuments<Ranking>(execution_policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename Ranking, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, const DocumentFilter &filter,
+                                                     size_t max_result_count) const
+{
+    const Query query = ParseQuery(raw_query);
+    return FindTopDocumentsWithFilter<Ranking>(execution_policy, *version_.load(), query, filter, max_result_count);
+}
+
+template <typename Ranking, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const CorpusStatistics &corpus, const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_result_count) const
+{
+    const Query query = ParseQuery(raw_query);
+    return FindTopDocumentsInVersion<Ranking>(std::execution::seq, *version_.load(), query, document_predicate, max_result_count, &corpus);
+}
+
+template <std::invocable<int, DocumentStatus, int> DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsByProximity(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                                size_t max_result_count) const
+{
+    if (!positions_enabled_)
+    {
+        throw std::invalid_argument("Proximity ranking needs word positions"s);
+    }
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    std::vector<Document> documents = FindTopDocumentsInVersion(std::execution::seq, *version, query, document_predicate,
+                                                                max_result_count * PROXIMITY_CANDIDATE_FACTOR);
+    for (Document &document : documents)
+    {
+        const uint32_t distance = ComputePlusWordDistance(*version, query, document.id);
+        if (distance != 0)
+        {
+            document.relevance *= 1.0 + 1.0 / distance;
+        }
+    }
+    SelectTopDocuments(std::execution::seq, documents, max_result_count);
+    return documents;
+}
+
+template <typename Ranking, typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsInVersion(const ExecutionPolicy &execution_policy, const IndexVersion &version, const Query &query,
+                                                              DocumentPredicate document_predicate, size_t max_result_count, const CorpusStatistics *corpus,
+                                                              const Bitmap *rejected) const
 {
-    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, document_predicate);
+    auto matched_documents = FindAllDocuments<Ranking>(execution_policy, version, query, document_predicate, corpus, rejected);
+
+    SelectTopDocuments(execution_policy, matched_documents, max_result_count);
+    return matched_documents;
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentPredicate document_predicate) const
+// The predicate lets everything through; the filter has already rejected
+// what it has to.
+template <typename Ranking, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsWithFilter(const ExecutionPolicy &execution_policy, const IndexVersion &version, const Query &query,
+                                                               const DocumentFilter &filter, size_t max_result_count) const
 {
-    std::vector<std::string_view> vec_query = SplitIntoWordsView(raw_query);
-    const Query query = ParseQuery(vec_query);
+    const auto document_predicate = [](int document_id, DocumentStatus document_status, int rating) {
+        return true;
+    };
+    const Bitmap rejected = RejectDocuments(version, filter);
+    return FindTopDocumentsInVersion<Ranking>(execution_policy, version, query, document_predicate, max_result_count, nullptr, &rejected);
+}
 
-    auto matched_documents = FindAllDocuments(execution_policy, query, document_predicate);
+// The result is looked up and computed on one version, so it is cached
+// under the generation it belongs to.
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsWithStatus(const ExecutionPolicy &execution_policy, const std::string_view &raw_query, DocumentStatus status,
+                                                               size_t max_result_count) const
+{
+    DocumentFilter filter;
+    filter.statuses = {status};
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    if (!result_cache_)
+    {
+        return FindTopDocumentsWithFilter<TfIdfRanking>(execution_policy, *version, query, filter, max_result_count);
+    }
+    const ResultCacheKey key = MakeResultCacheKey(query, status, max_result_count);
+    std::vector<Document> documents;
+    if (!result_cache_->Find(key, version->generation, documents))
+    {
+        documents = FindTopDocumentsWithFilter<TfIdfRanking>(execution_policy, *version, query, filter, max_result_count);
+        result_cache_->Insert(key, version->generation, documents);
+    }
+    return documents;
+}
+
+// Segments are searched in ordinal order and share the top documents, so
+// the bar for entering them carries over from one segment to the next.
+template <std::invocable<int, DocumentStatus, int> DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsPruned(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                           size_t max_result_count) const
+{
+    const Query query = ParseQuery(raw_query);
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    if (max_result_count == 0)
+    {
+        return {};
+    }
+    if (!query.phrases.empty())
+    {
+        return FindTopDocumentsInVersion(std::execution::seq, *version, query, document_predicate, max_result_count);
+    }
 
-    sort(execution_policy, matched_documents.begin(), matched_documents.end(), [](const Document &lhs, const Document &rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < 1e-6)
+    Bitmap excluded(version->end_ordinal);
+    for (const std::string_view &word : query.minus_words)
+    {
+        const TermPostings term = LookUpTerm(*version, word);
+        for (const auto &[published, postings] : term.postings)
         {
-            return lhs.rating > rhs.rating;
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                excluded.Set(published->first_ordinal + ordinal);
+            });
         }
-        else
+    }
+
+    // Word, postings and weight of the plus words in each segment.
+    const TfIdfRanking ranking(version->document_count, version->word_count);
+    std::vector<std::vector<std::tuple<std::string_view, PostingListView, double>>> segment_postings(version->segments.size());
+    for (const std::string_view &word : query.plus_words)
+    {
+        const TermPostings term = LookUpTerm(*version, word);
+        if (term.document_count == 0)
         {
-            return lhs.relevance > rhs.relevance;
+            continue;
         }
-    });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT)
+        const double word_weight = ranking.WordWeight(term.document_count);
+        for (const auto &[published, postings] : term.postings)
+        {
+            segment_postings[published - version->segments.data()].emplace_back(word, postings, word_weight);
+        }
+    }
+
+    std::vector<Document> top_documents;
+    std::vector<BoundedTerm> terms;
+    for (size_t i = 0; i < version->segments.size(); ++i)
     {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+        const PublishedSegment &published = version->segments[i];
+        terms.clear();
+        for (const auto &[word, postings, word_weight] : segment_postings[i])
+        {
+            const std::span<const TermFreq> max_term_freqs = published.segment->MaxTermFreqs(word);
+            double max_relevance = 0.0;
+            for (const TermFreq &max_term_freq : max_term_freqs)
+            {
+                max_relevance = std::max(max_relevance, ranking.Score(word_weight, max_term_freq.term_count, max_term_freq.document_length));
+            }
+            terms.push_back({PostingCursor(postings), max_term_freqs, word_weight, max_relevance});
+        }
+        FindTopDocumentsInSegment(published, ranking, terms, excluded, document_predicate, max_result_count, top_documents);
     }
-    return matched_documents;
+    std::sort_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+    return top_documents;
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const ExecutionPolicy &execution_policy, const Query &query, DocumentPredicate document_predicate) const
+// Terms are ranked by their bound. The lowest ranked terms whose bounds
+// add up to less than the bar are not essential: a document containing
+// only them cannot enter the top documents, so candidates are taken from
+// the essential terms alone. A candidate is scored on the essential terms,
+// then looked up in the others from the highest ranked down while its
+// score plus the block maxima of the terms left can still reach the bar.
+// The bar is lowered by RELEVANCE_TOLERANCE, so documents that tie with
+// the last of the top documents are still scored and the rating decides as
+// in FindTopDocuments.
+template <typename DocumentPredicate>
+void SearchServer::FindTopDocumentsInSegment(const PublishedSegment &published, const TfIdfRanking &ranking, std::vector<BoundedTerm> &terms, const Bitmap &excluded,
+                                             DocumentPredicate document_predicate, size_t max_result_count, std::vector<Document> &top_documents)
 {
-    ConcurrentMap<int, double> document_to_relevance(NUMBER_PARALLEL_PROCESSES);
-    for (const std::string_view &word : query.plus_words)
+    if (terms.empty())
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        return;
+    }
+    const IndexSegment &segment = *published.segment;
+    const uint32_t end_ordinal = std::numeric_limits<uint32_t>::max();
+    // Indexes into terms by ascending bound; ordinals[i] is the current
+    // ordinal of terms[ranked[i]], end_ordinal once exhausted.
+    std::vector<size_t> ranked(terms.size());
+    std::iota(ranked.begin(), ranked.end(), 0);
+    std::sort(ranked.begin(), ranked.end(), [&terms](size_t lhs, size_t rhs) {
+        return terms[lhs].max_relevance < terms[rhs].max_relevance;
+    });
+    std::vector<uint32_t> ordinals(terms.size());
+    // bounds[i] is the summed bound of the terms ranked below i.
+    std::vector<double> bounds(terms.size() + 1, 0.0);
+    for (size_t i = 0; i < ranked.size(); ++i)
+    {
+        const PostingCursor &cursor = terms[ranked[i]].cursor;
+        ordinals[i] = cursor.AtEnd() ? end_ordinal : cursor.Ordinal();
+        bounds[i + 1] = bounds[i] + terms[ranked[i]].max_relevance;
+    }
+
+    size_t first_essential = 0;
+    uint32_t next_ordinal = *std::min_element(ordinals.begin(), ordinals.end());
+    // Indexes into terms of the words found in the candidate, with what
+    // they add to its relevance.
+    std::vector<std::pair<size_t, double>> matched;
+    while (true)
+    {
+        const double bar = top_documents.size() < max_result_count ? -std::numeric_limits<double>::infinity()
+                                                                    : top_documents.front().relevance - RELEVANCE_TOLERANCE;
+        if (first_essential < ranked.size() && bounds[first_essential + 1] < bar)
+        {
+            while (first_essential < ranked.size() && bounds[first_essential + 1] < bar)
+            {
+                ++first_essential;
+            }
+            next_ordinal = first_essential == ranked.size() ? end_ordinal : *std::min_element(ordinals.begin() + first_essential, ordinals.end());
+        }
+        const uint32_t ordinal = next_ordinal;
+        if (ordinal == end_ordinal)
+        {
+            return;
+        }
+
+        const bool accepted = !published.IsRemoved(ordinal) && !excluded.Test(published.first_ordinal + ordinal)
+                              && document_predicate(segment.DocumentId(ordinal), segment.Status(ordinal), segment.Rating(ordinal));
+        const uint32_t word_count = segment.WordCount(ordinal);
+        matched.clear();
+        double relevance = 0.0;
+        next_ordinal = end_ordinal;
+        for (size_t i = first_essential; i < ranked.size(); ++i)
+        {
+            if (ordinals[i] != ordinal)
+            {
+                next_ordinal = std::min(next_ordinal, ordinals[i]);
+                continue;
+            }
+            BoundedTerm &term = terms[ranked[i]];
+            if (accepted)
+            {
+                const double term_relevance = ranking.Score(term.word_weight, term.cursor.TermCount(), word_count);
+                matched.emplace_back(ranked[i], term_relevance);
+                relevance += term_relevance;
+            }
+            term.cursor.Next();
+            ordinals[i] = term.cursor.AtEnd() ? end_ordinal : term.cursor.Ordinal();
+            next_ordinal = std::min(next_ordinal, ordinals[i]);
+        }
+        if (!accepted)
+        {
+            continue;
+        }
+
+        bool pruned = false;
+        for (size_t i = first_essential; i-- > 0;)
+        {
+            BoundedTerm &term = terms[ranked[i]];
+            if (ordinals[i] < ordinal)
+            {
+                const size_t block_index = term.cursor.FindBlock(ordinal);
+                double max_block_relevance = 0.0;
+                if (block_index != term.cursor.BlockCount())
+                {
+                    const TermFreq &max_term_freq = term.max_term_freqs[block_index];
+                    max_block_relevance = ranking.Score(term.word_weight, max_term_freq.term_count, max_term_freq.document_length);
+                }
+                if (relevance + bounds[i] + max_block_relevance < bar)
+                {
+                    pruned = true;
+                    break;
+                }
+                term.cursor.SkipTo(ordinal);
+                ordinals[i] = term.cursor.AtEnd() ? end_ordinal : term.cursor.Ordinal();
+            }
+            if (ordinals[i] == ordinal)
+            {
+                const double term_relevance = ranking.Score(term.word_weight, term.cursor.TermCount(), word_count);
+                matched.emplace_back(ranked[i], term_relevance);
+                relevance += term_relevance;
+            }
+            else if (relevance + bounds[i] < bar)
+            {
+                pruned = true;
+                break;
+            }
+        }
+        if (pruned)
         {
             continue;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        std::for_each(execution_policy, word_to_document_freqs_.find(word)->second.begin(), word_to_document_freqs_.find(word)->second.end(),
-                      [&](const auto doc_id_word_freqs) {const auto &document_data = documents_.at(doc_id_word_freqs.first);
-            if (document_predicate(doc_id_word_freqs.first, document_data.status, document_data.rating))
+
+        // Summed again in word order, as FindAllDocuments does.
+        std::sort(matched.begin(), matched.end());
+        relevance = 0.0;
+        for (const auto &[term_index, term_relevance] : matched)
+        {
+            relevance += term_relevance;
+        }
+        PushTopDocument(top_documents, {segment.DocumentId(ordinal), relevance, segment.Rating(ordinal)}, max_result_count);
+    }
+}
+
+template <typename ExecutionPolicy>
+size_t SearchServer::ParallelTaskCount(const ExecutionPolicy &execution_policy)
+{
+    if constexpr (std::is_same_v<ExecutionPolicy, PoolExecutionPolicy>)
+    {
+        return execution_policy.pool->ThreadCount();
+    }
+    else
+    {
+        return NUMBER_PARALLEL_PROCESSES;
+    }
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, typename ResultHandler>
+void SearchServer::FindTopDocumentsBatch(const ExecutionPolicy &execution_policy, const std::vector<std::string> &raw_queries, DocumentPredicate document_predicate,
+                                         ResultHandler handle_result, size_t max_result_count) const
+{
+    const std::shared_ptr<const IndexVersion> version = version_.load();
+    std::vector<size_t> phrase_queries;
+    const TfIdfRanking ranking(version->document_count, version->word_count);
+    const std::vector<BatchTerm> terms = PlanQueryBatch(*version, ranking, raw_queries, phrase_queries);
+    // Up to one window per task is scored at a time.
+    const size_t round_query_count = BATCH_WINDOW_QUERY_COUNT * ParallelTaskCount(execution_policy);
+    for (size_t first_query = 0; first_query < raw_queries.size(); first_query += round_query_count)
+    {
+        std::vector<size_t> window_begins;
+        for (size_t i = first_query; i < std::min(first_query + round_query_count, raw_queries.size()); i += BATCH_WINDOW_QUERY_COUNT)
+        {
+            window_begins.push_back(i);
+        }
+        std::vector<std::vector<std::vector<Document>>> window_documents(window_begins.size());
+        ParallelFor(execution_policy, window_begins.size(), [&](size_t i) {
+            const size_t window_end = std::min(window_begins[i] + BATCH_WINDOW_QUERY_COUNT, raw_queries.size());
+            window_documents[i] = FindTopDocumentsInWindow(*version, ranking, terms, window_begins[i], window_end, document_predicate, max_result_count);
+        });
+        for (size_t i = 0; i < window_begins.size(); ++i)
+        {
+            for (size_t j = 0; j < window_documents[i].size(); ++j)
             {
-                document_to_relevance[doc_id_word_freqs.first].ref_to_value += doc_id_word_freqs.second * inverse_document_freq;
-            } });
+                const size_t query_index = window_begins[i] + j;
+                if (std::binary_search(phrase_queries.begin(), phrase_queries.end(), query_index))
+                {
+                    window_documents[i][j] = FindTopDocumentsInVersion(std::execution::seq, *version, ParseQuery(raw_queries[query_index]), document_predicate,
+                                                                       max_result_count);
+                }
+                handle_result(query_index, std::move(window_documents[i][j]));
+            }
+        }
+    }
+}
+
+// Every posting list of the window's words is walked once, and the
+// metadata of a posting is read and filtered once for all the queries of
+// the window using the word. Each query scores into an accumulator lent
+// by the thread, which is cleared of only what the query touched. Only the
+// top documents of each query are kept while collecting, so a window holds
+// few documents at a time.
+template <typename DocumentPredicate>
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsInWindow(const IndexVersion &version, const TfIdfRanking &ranking, const std::vector<BatchTerm> &terms,
+                                                                          size_t first_query, size_t last_query, DocumentPredicate document_predicate,
+                                                                          size_t max_result_count)
+{
+    std::vector<RelevanceAccumulator::Lease> document_to_relevance;
+    document_to_relevance.reserve(last_query - first_query);
+    for (size_t query = first_query; query < last_query; ++query)
+    {
+        document_to_relevance.push_back(RelevanceAccumulator::Lend(version.end_ordinal));
+    }
+
+    for (const BatchTerm &term : terms)
+    {
+        const std::span<const size_t> queries = QueriesInWindow(term.minus_queries, first_query, last_query);
+        if (queries.empty())
+        {
+            continue;
+        }
+        for (const auto &[published, postings] : term.postings)
+        {
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                for (const size_t query : queries)
+                {
+                    document_to_relevance[query - first_query]->Exclude(published->first_ordinal + ordinal);
+                }
+            });
+        }
+    }
+
+    for (const BatchTerm &term : terms)
+    {
+        const std::span<const size_t> queries = QueriesInWindow(term.plus_queries, first_query, last_query);
+        if (queries.empty())
+        {
+            continue;
+        }
+        for (const auto &[published, postings] : term.postings)
+        {
+            const IndexSegment &segment = *published->segment;
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                if (published->IsRemoved(ordinal) || !document_predicate(segment.DocumentId(ordinal), segment.Status(ordinal), segment.Rating(ordinal)))
+                {
+                    return;
+                }
+                const double relevance = ranking.Score(term.word_weight, term_count, segment.WordCount(ordinal));
+                for (const size_t query : queries)
+                {
+                    document_to_relevance[query - first_query]->Add(published->first_ordinal + ordinal, relevance);
+                }
+            });
+        }
     }
 
+    std::vector<std::vector<Document>> matched_documents(last_query - first_query);
+    for (const BatchTerm &term : terms)
+    {
+        const std::span<const size_t> queries = QueriesInWindow(term.plus_queries, first_query, last_query);
+        if (queries.empty())
+        {
+            continue;
+        }
+        for (const auto &[published, postings] : term.postings)
+        {
+            const IndexSegment &segment = *published->segment;
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                for (const size_t query : queries)
+                {
+                    double relevance;
+                    if (document_to_relevance[query - first_query]->Take(published->first_ordinal + ordinal, relevance))
+                    {
+                        PushTopDocument(matched_documents[query - first_query], {segment.DocumentId(ordinal), relevance, segment.Rating(ordinal)}, max_result_count);
+                    }
+                }
+            });
+        }
+    }
+    for (std::vector<Document> &documents : matched_documents)
+    {
+        std::sort_heap(documents.begin(), documents.end(), IsMoreRelevant);
+    }
+    return matched_documents;
+}
+
+template <typename Ranking, typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const ExecutionPolicy &execution_policy, const IndexVersion &version, const Query &query, DocumentPredicate document_predicate,
+                                                     const CorpusStatistics *corpus, const Bitmap *rejected) const
+{
+    const Ranking ranking = corpus == nullptr ? Ranking(version.document_count, version.word_count) : Ranking(corpus->document_count, corpus->word_count);
+    std::pmr::memory_resource *memory_resource = QueryMemoryResource();
+    const RelevanceAccumulator::Lease lease = RelevanceAccumulator::Lend(version.end_ordinal);
+    RelevanceAccumulator &document_to_relevance = *lease;
+    if (rejected != nullptr)
+    {
+        document_to_relevance.Exclude(*rejected);
+    }
+    const Bitmap phrase_matches = query.phrases.empty() ? Bitmap() : MatchPhrases(version, query);
     for (const std::string_view &word : query.minus_words)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        const TermPostings term = LookUpTerm(version, word, memory_resource);
+        for (const auto &[published, postings] : term.postings)
+        {
+            postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+                document_to_relevance.Exclude(published->first_ordinal + ordinal);
+            });
+        }
+    }
+
+    std::pmr::vector<std::pair<const PublishedSegment *, PostingListView>> plus_word_postings(memory_resource);
+    for (const std::string_view &word : query.plus_words)
+    {
+        const TermPostings term = LookUpTerm(version, word, memory_resource);
+        if (term.document_count == 0)
         {
             continue;
         }
-        std::for_each(execution_policy, word_to_document_freqs_.find(word)->second.begin(), word_to_document_freqs_.find(word)->second.end(),
-                      [&](const auto doc_id_word_freqs) { document_to_relevance.BuildOrdinaryMap().erase(doc_id_word_freqs.first); });
+        const double word_weight = ranking.WordWeight(corpus == nullptr ? term.document_count : corpus->WordDocumentCount(word));
+        for (const auto &[published, postings] : term.postings)
+        {
+            const IndexSegment &segment = *published->segment;
+            plus_word_postings.emplace_back(published, postings);
+            postings.ForEach(execution_policy, [&](uint32_t ordinal, uint32_t term_count) {
+                const uint32_t version_ordinal = published->first_ordinal + ordinal;
+                if (published->IsRemoved(ordinal) || document_to_relevance.IsExcluded(version_ordinal)
+                    || !(query.phrases.empty() || phrase_matches.Test(version_ordinal)))
+                {
+                    return;
+                }
+                if (document_predicate(segment.DocumentId(ordinal), segment.Status(ordinal), segment.Rating(ordinal)))
+                {
+                    document_to_relevance.Add(version_ordinal, ranking.Score(word_weight, term_count, segment.WordCount(ordinal)));
+                }
+            });
+        }
     }
 
     std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap())
+    for (const auto &[published, postings] : plus_word_postings)
     {
-        matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+        const IndexSegment &segment = *published->segment;
+        postings.ForEach([&](uint32_t ordinal, uint32_t term_count) {
+            double relevance;
+            if (document_to_relevance.Take(published->first_ordinal + ordinal, relevance))
+            {
+                matched_documents.push_back({segment.DocumentId(ordinal), relevance, segment.Rating(ordinal)});
+            }
+        });
     }
     return matched_documents;
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "sharded_search_server.h"
+
+#include <functional>
+#include <unordered_set>
+
+ShardedSearchServer::ShardedSearchServer(const std::string_view &stop_words_text, size_t shard_count)
+{
+    if (shard_count == 0)
+    {
+        throw std::invalid_argument("Shard count must be positive"s);
+    }
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        shards_.push_back(std::make_unique<SearchServer>(stop_words_text));
+    }
+}
+
+void ShardedSearchServer::EnablePositions()
+{
+    for (const std::unique_ptr<SearchServer> &shard : shards_)
+    {
+        shard->EnablePositions();
+    }
+}
+
+void ShardedSearchServer::AddDocument(int document_id, const std::string_view &document, DocumentStatus status, const std::vector<int> &ratings)
+{
+    std::lock_guard lock(writer_mutex_);
+    ShardOf(document_id).AddDocument(document_id, document, status, ratings);
+}
+
+// Documents are checked in batch order, so the first rejected one is
+// reported, as by SearchServer::AddDocuments.
+void ShardedSearchServer::AddDocuments(const std::vector<DocumentInput> &documents)
+{
+    std::lock_guard lock(writer_mutex_);
+    std::unordered_set<int> batch_ids;
+    for (const DocumentInput &document : documents)
+    {
+        if ((document.id < 0) || ShardOf(document.id).ContainsDocument(document.id) || !batch_ids.insert(document.id).second)
+        {
+            throw std::invalid_argument("Invalid document_id"s);
+        }
+        SearchServer::CheckDocumentWords(document.text);
+    }
+    std::vector<std::vector<DocumentInput>> shard_documents(shards_.size());
+    for (const DocumentInput &document : documents)
+    {
+        shard_documents[ShardIndex(document.id)].push_back(document);
+    }
+    ForEachShard([&](size_t shard_index) {
+        shards_[shard_index]->AddDocuments(shard_documents[shard_index]);
+    });
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentStatus status, size_t max_result_count) const
+{
+    return FindTopDocuments(
+        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        },
+        max_result_count);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(const std::string_view &raw_query, int document_id) const
+{
+    return ShardOf(document_id).MatchDocument(raw_query, document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id)
+{
+    std::lock_guard lock(writer_mutex_);
+    ShardOf(document_id).RemoveDocument(document_id);
+}
+
+int ShardedSearchServer::GetDocumentCount() const
+{
+    int document_count = 0;
+    for (const std::unique_ptr<SearchServer> &shard : shards_)
+    {
+        document_count += shard->GetDocumentCount();
+    }
+    return document_count;
+}
+
+size_t ShardedSearchServer::ShardCount() const
+{
+    return shards_.size();
+}
+
+const SearchServer &ShardedSearchServer::Shard(size_t shard_index) const
+{
+    return *shards_.at(shard_index);
+}
+
+size_t ShardedSearchServer::ShardIndex(int document_id) const
+{
+    return std::hash<int>{}(document_id) % shards_.size();
+}
+
+SearchServer &ShardedSearchServer::ShardOf(int document_id)
+{
+    return *shards_[ShardIndex(document_id)];
+}
+
+const SearchServer &ShardedSearchServer::ShardOf(int document_id) const
+{
+    return *shards_[ShardIndex(document_id)];
+}
+
+// Every shard parses the query alike, so their counts cover the same words.
+CorpusStatistics ShardedSearchServer::GetCorpusStatistics(const std::string_view &raw_query) const
+{
+    std::vector<CorpusStatistics> shard_statistics(shards_.size());
+    ForEachShard([&](size_t shard_index) {
+        shard_statistics[shard_index] = shards_[shard_index]->GetCorpusStatistics(raw_query);
+    });
+    CorpusStatistics statistics = std::move(shard_statistics.front());
+    for (size_t i = 1; i < shard_statistics.size(); ++i)
+    {
+        statistics.Merge(shard_statistics[i]);
+    }
+    return statistics;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <concepts>
+#include <exception>
+#include <execution>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// Splits the documents over shard_count SearchServer shards by a hash of
+// the document id. A query is scattered to all shards in parallel: the
+// shards first count the documents containing its words, then rank their
+// own documents by the summed counts, so relevances are those of a single
+// server holding every document. The per-shard top documents are merged.
+// A query running concurrently with writers may see the counts and the
+// documents of different moments. Every shard parses the query twice, once
+// per pass, so sharding only pays off with a core per shard.
+class ShardedSearchServer
+{
+public:
+    explicit ShardedSearchServer(const std::string_view &stop_words_text, size_t shard_count = NUMBER_PARALLEL_PROCESSES);
+
+    // SearchServer::EnablePositions on every shard.
+    void EnablePositions();
+
+    void AddDocument(int document_id, const std::string_view &document, DocumentStatus status, const std::vector<int> &ratings);
+
+    // The whole batch is checked before any shard adds its part, in
+    // parallel, so a rejected document leaves every shard unchanged.
+    void AddDocuments(const std::vector<DocumentInput> &documents);
+
+    template <typename Ranking = TfIdfRanking, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view &raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+                                           size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view &raw_query, int document_id) const;
+
+    void RemoveDocument(int document_id);
+
+    int GetDocumentCount() const;
+
+    size_t ShardCount() const;
+
+    const SearchServer &Shard(size_t shard_index) const;
+
+private:
+    std::vector<std::unique_ptr<SearchServer>> shards_;
+    // Serializes writers, so that no document is added between the check
+    // of a batch and its scattering.
+    std::mutex writer_mutex_;
+
+    size_t ShardIndex(int document_id) const;
+
+    SearchServer &ShardOf(int document_id);
+
+    const SearchServer &ShardOf(int document_id) const;
+
+    CorpusStatistics GetCorpusStatistics(const std::string_view &raw_query) const;
+
+    // Calls function(shard_index) for every shard in parallel, then rethrows
+    // the exception of the first shard that failed.
+    template <typename Function>
+    void ForEachShard(Function function) const;
+};
+
+template <typename Ranking, std::invocable<int, DocumentStatus, int> DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::string_view &raw_query, DocumentPredicate document_predicate,
+                                                            size_t max_result_count) const
+{
+    const CorpusStatistics corpus = GetCorpusStatistics(raw_query);
+    std::vector<std::vector<Document>> shard_documents(shards_.size());
+    ForEachShard([&](size_t shard_index) {
+        shard_documents[shard_index] = shards_[shard_index]->FindTopDocuments<Ranking>(corpus, raw_query, document_predicate, max_result_count);
+    });
+    std::vector<Document> documents;
+    for (const std::vector<Document> &top_documents : shard_documents)
+    {
+        documents.insert(documents.end(), top_documents.begin(), top_documents.end());
+    }
+    const size_t result_count = std::min(max_result_count, documents.size());
+    std::partial_sort(documents.begin(), documents.begin() + result_count, documents.end(), SearchServer::IsMoreRelevant);
+    documents.resize(result_count);
+    return documents;
+}
+
+
+template <typename Function>
+void ShardedSearchServer::ForEachShard(Function function) const
+{
+    std::vector<size_t> shard_indexes(shards_.size());
+    std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+    std::vector<std::exception_ptr> errors(shards_.size());
+    std::for_each(std::execution::par, shard_indexes.begin(), shard_indexes.end(), [&](size_t shard_index) {
+        try
+        {
+            function(shard_index);
+        }
+        catch (...)
+        {
+            errors[shard_index] = std::current_exception();
+        }
+    });
+    for (const std::exception_ptr &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
\ No newline at end of file
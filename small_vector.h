@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Vector that keeps up to InlineCapacity values in place and moves them to
+// the heap only when it grows beyond that.
+template <typename Type, size_t InlineCapacity>
+class SmallVector
+{
+public:
+    void PushBack(const Type &value)
+    {
+        if (heap_.empty() && size_ < InlineCapacity)
+        {
+            inline_[size_++] = value;
+            return;
+        }
+        if (heap_.empty())
+        {
+            heap_.assign(inline_.begin(), inline_.begin() + size_);
+        }
+        heap_.push_back(value);
+        ++size_;
+    }
+
+    // Drops the values from size on.
+    void Truncate(size_t size)
+    {
+        size_ = std::min(size_, size);
+        if (!heap_.empty())
+        {
+            heap_.resize(size_);
+        }
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    bool Empty() const
+    {
+        return size_ == 0;
+    }
+
+    Type *begin()
+    {
+        return heap_.empty() ? inline_.data() : heap_.data();
+    }
+
+    Type *end()
+    {
+        return begin() + size_;
+    }
+
+    const Type *begin() const
+    {
+        return heap_.empty() ? inline_.data() : heap_.data();
+    }
+
+    const Type *end() const
+    {
+        return begin() + size_;
+    }
+
+private:
+    std::array<Type, InlineCapacity> inline_;
+    std::vector<Type> heap_;
+    size_t size_ = 0;
+};
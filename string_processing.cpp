@@ -1,47 +1,47 @@
 #include "string_processing.h"
 
-std::vector<std::string> SplitIntoWords(const std::string_view &text)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+size_t FindSpace(std::string_view text, size_t position)
 {
-    std::vector<std::string> words;
-    std::string word;
-    for (const char c : text)
+#if defined(__SSE2__)
+    const __m128i spaces = _mm_set1_epi8(' ');
+    for (; position + 16 <= text.size(); position += 16)
     {
-        if (c == ' ')
-        {
-            if (!word.empty())
-            {
-                words.push_back(std::move(word));
-                word.clear();
-            }
-        }
-        else
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + position));
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, spaces));
+        if (mask != 0)
         {
-            word += c;
+            return position + __builtin_ctz(mask);
         }
     }
-    if (!word.empty())
+#endif
+    while (position < text.size() && text[position] != ' ')
     {
-        words.push_back(std::move(word));
+        ++position;
     }
+    return position;
+}
 
+std::vector<std::string> SplitIntoWords(const std::string_view &text)
+{
+    std::vector<std::string> words;
+    ForEachWordView(text, [&words](std::string_view word) {
+        if (!word.empty())
+        {
+            words.emplace_back(word);
+        }
+    });
     return words;
 }
 
 std::vector<std::string_view> SplitIntoWordsView(std::string_view text)
 {
     std::vector<std::string_view> words;
-    while (true)
-    {
-        int64_t space = text.find(' ', 0);
-        words.push_back(space == static_cast<int64_t>(text.npos) ? text.substr(0) : text.substr(0, space - 0));
-        if (space == static_cast<int64_t>(text.npos))
-        {
-            break;
-        }
-        else
-        {
-            text.remove_prefix(space + 1);
-        }
-    }
+    ForEachWordView(text, [&words](std::string_view word) {
+        words.push_back(word);
+    });
     return words;
 }
\ No newline at end of file
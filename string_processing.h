@@ -4,6 +4,28 @@
 #include <set>
 #include <string_view>
 
+// Position of the first space in text at or after position, or text.size()
+// if there is none. Scans 16 characters at a time with SSE2 when available.
+size_t FindSpace(std::string_view text, size_t position);
+
+// Calls function(word) for every piece of text between spaces, including
+// the empty ones around adjacent spaces, without allocating.
+template <typename Function>
+void ForEachWordView(std::string_view text, Function function)
+{
+    size_t word_begin = 0;
+    while (true)
+    {
+        const size_t space = FindSpace(text, word_begin);
+        function(text.substr(word_begin, space - word_begin));
+        if (space == text.size())
+        {
+            break;
+        }
+        word_begin = space + 1;
+    }
+}
+
 std::vector<std::string> SplitIntoWords(const std::string_view &text);
 
 std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
@@ -0,0 +1,50 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+
+uint32_t TermDictionary::Intern(std::string_view word)
+{
+    const auto it = word_to_term_id_.find(word);
+    if (it != word_to_term_id_.end())
+    {
+        return it->second;
+    }
+    const std::string_view stored_word = Store(word);
+    const uint32_t term_id = words_.size();
+    words_.push_back(stored_word);
+    word_to_term_id_.emplace(stored_word, term_id);
+    return term_id;
+}
+
+uint32_t TermDictionary::Find(std::string_view word) const
+{
+    const auto it = word_to_term_id_.find(word);
+    return it == word_to_term_id_.end() ? NO_TERM : it->second;
+}
+
+std::string_view TermDictionary::Word(uint32_t term_id) const
+{
+    return words_[term_id];
+}
+
+size_t TermDictionary::Size() const
+{
+    return words_.size();
+}
+
+// Words longer than a chunk get a chunk of their own.
+std::string_view TermDictionary::Store(std::string_view word)
+{
+    if (word.size() > chunk_free_)
+    {
+        const size_t chunk_size = std::max(CHUNK_SIZE, word.size());
+        chunks_.push_back(std::make_unique<char[]>(chunk_size));
+        chunk_position_ = chunks_.back().get();
+        chunk_free_ = chunk_size;
+    }
+    char *stored_word = chunk_position_;
+    std::copy(word.begin(), word.end(), stored_word);
+    chunk_position_ += word.size();
+    chunk_free_ -= word.size();
+    return {stored_word, word.size()};
+}
\ No newline at end of file
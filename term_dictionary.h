@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Term frequency of a word in a document, identified by its term id.
+struct TermFrequency
+{
+    uint32_t term_id;
+    double freq;
+};
+
+// Assigns dense ids to words in order of first appearance and stores every
+// word once, in large chunks that are never moved or freed: views returned
+// by Word stay valid for the lifetime of the dictionary.
+class TermDictionary
+{
+public:
+    static const uint32_t NO_TERM = UINT32_MAX;
+
+    TermDictionary() = default;
+
+    TermDictionary(const TermDictionary &) = delete;
+
+    TermDictionary &operator=(const TermDictionary &) = delete;
+
+    uint32_t Intern(std::string_view word);
+
+    // Returns NO_TERM if the word has not been interned.
+    uint32_t Find(std::string_view word) const;
+
+    std::string_view Word(uint32_t term_id) const;
+
+    size_t Size() const;
+
+private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char *chunk_position_ = nullptr;
+    size_t chunk_free_ = 0;
+    std::vector<std::string_view> words_;
+    std::unordered_map<std::string_view, uint32_t> word_to_term_id_;
+
+    std::string_view Store(std::string_view word);
+};
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "thread_pool.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    thread_local const ThreadPool *current_pool = nullptr;
+    thread_local size_t current_worker = 0;
+
+#if defined(__linux__)
+    // CPUs the process may run on, as restricted by taskset or cgroups.
+    std::vector<int> AllowedCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &allowed))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        return cpus;
+    }
+#endif
+}
+
+ThreadPool::TaskGroup::TaskGroup(size_t task_count)
+    : remaining(task_count)
+{
+}
+
+// Everything is done under the lock, so that the waiter cannot destroy
+// the group before the last task is done with it.
+void ThreadPool::TaskGroup::Finish(std::exception_ptr task_error)
+{
+    std::lock_guard lock(mutex);
+    if (task_error && !error)
+    {
+        error = task_error;
+    }
+    if (remaining.fetch_sub(1) == 1)
+    {
+        finished.notify_all();
+    }
+}
+
+ThreadPool::ThreadPool(size_t thread_count, bool pin_threads)
+{
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+#if defined(__linux__)
+    const std::vector<int> allowed_cpus = pin_threads ? AllowedCpus() : std::vector<int>();
+#endif
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        threads_.emplace_back([this, i](std::stop_token stop_token) {
+            Run(stop_token, i);
+        });
+#if defined(__linux__)
+        if (!allowed_cpus.empty())
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(allowed_cpus[i % allowed_cpus.size()], &cpus);
+            pthread_setaffinity_np(threads_.back().native_handle(), sizeof(cpus), &cpus);
+        }
+#endif
+    }
+}
+
+size_t ThreadPool::ThreadCount() const
+{
+    return workers_.size();
+}
+
+PoolExecutionPolicy ThreadPool::Policy()
+{
+    return {this};
+}
+
+void ThreadPool::Submit(Task task)
+{
+    const size_t worker_index = CurrentWorker();
+    // Counted before it can be taken, so that the count never wraps.
+    ++pending_task_count_;
+    {
+        Worker &worker = worker_index < workers_.size() ? *workers_[worker_index] : submitted_;
+        std::lock_guard lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard lock(wake_mutex_);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::RunTask(size_t worker_index)
+{
+    std::function<void()> task;
+    for (size_t i = 0; i <= workers_.size() && !task; ++i)
+    {
+        Worker &worker = i == 0 ? *workers_[worker_index] : i == 1 ? submitted_ : *workers_[(worker_index + i - 1) % workers_.size()];
+        std::lock_guard lock(worker.mutex);
+        if (worker.tasks.empty())
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            task = std::move(worker.tasks.back().function);
+            worker.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(worker.tasks.front().function);
+            worker.tasks.pop_front();
+        }
+    }
+    if (!task)
+    {
+        return false;
+    }
+    --pending_task_count_;
+    task();
+    return true;
+}
+
+bool ThreadPool::RunGroupTask(size_t worker_index, const TaskGroup &group)
+{
+    std::function<void()> task;
+    {
+        Worker &worker = *workers_[worker_index];
+        std::lock_guard lock(worker.mutex);
+        if (worker.tasks.empty() || worker.tasks.back().group != &group)
+        {
+            return false;
+        }
+        task = std::move(worker.tasks.back().function);
+        worker.tasks.pop_back();
+    }
+    --pending_task_count_;
+    task();
+    return true;
+}
+
+void ThreadPool::Run(std::stop_token stop_token, size_t worker_index)
+{
+    current_pool = this;
+    current_worker = worker_index;
+    while (!stop_token.stop_requested())
+    {
+        if (RunTask(worker_index))
+        {
+            continue;
+        }
+        std::unique_lock lock(wake_mutex_);
+        wake_.wait(lock, stop_token, [this]() {
+            return pending_task_count_ > 0;
+        });
+    }
+}
+
+size_t ThreadPool::CurrentWorker() const
+{
+    return current_pool == this ? current_worker : workers_.size();
+}
+
+// A thread of the pool runs the tasks of the group nobody has stolen, then
+// sleeps like any other thread until the stolen ones are done. It never
+// runs tasks of other groups meanwhile, which might wait for a lock it
+// holds.
+void ThreadPool::Wait(TaskGroup &group)
+{
+    const size_t worker_index = CurrentWorker();
+    if (worker_index < workers_.size())
+    {
+        while (RunGroupTask(worker_index, group))
+        {
+        }
+    }
+    std::unique_lock lock(group.mutex);
+    group.finished.wait(lock, [&group]() {
+        return group.remaining == 0;
+    });
+    if (group.error)
+    {
+        std::rethrow_exception(group.error);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <compare>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+// Execution policy that runs the parallel parts of an algorithm on a
+// ThreadPool; obtained with ThreadPool::Policy().
+struct PoolExecutionPolicy
+{
+    ThreadPool *pool;
+};
+
+// Ranges given to ParallelFor are split into up to this many tasks per
+// thread, so that idle threads have something to steal.
+static const size_t POOL_TASKS_PER_THREAD = 4;
+
+// Work-stealing pool of a fixed number of threads. Each thread takes tasks
+// from the back of its own queue and steals from the front of the others.
+// Tasks submitted from a thread of the pool go to its own queue, and a
+// thread of the pool waiting for them runs those still queued itself, so
+// nested parallel loops share the threads instead of adding new ones.
+// Pools are isolated: a thread only runs tasks of its own pool.
+class ThreadPool
+{
+public:
+    // Pinning binds thread i to the i-th CPU, modulo their count, of those
+    // the process is allowed to run on, where the platform supports it.
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency(), bool pin_threads = false);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t ThreadCount() const;
+
+    PoolExecutionPolicy Policy();
+
+    // Calls function(i) for every i below count on the threads of the
+    // pool and returns once all calls are done. The first exception thrown
+    // by a call is rethrown once the rest have finished.
+    template <typename Function>
+    void ParallelFor(size_t count, Function function);
+
+private:
+    // Tasks of one ParallelFor call.
+    struct TaskGroup
+    {
+        explicit TaskGroup(size_t task_count);
+
+        void Finish(std::exception_ptr error);
+
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+
+    struct Task
+    {
+        std::function<void()> function;
+        const TaskGroup *group;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Tasks submitted from outside the pool. The queue of a worker only
+    // holds tasks it submitted itself.
+    Worker submitted_;
+    std::atomic<size_t> pending_task_count_ = 0;
+    std::mutex wake_mutex_;
+    std::condition_variable_any wake_;
+
+    // Declared last so that they are stopped before the queues are destroyed.
+    std::vector<std::jthread> threads_;
+
+    void Submit(Task task);
+
+    // Runs one task of the queue of the worker, submitted from outside or
+    // stolen from another worker, in that order of preference.
+    bool RunTask(size_t worker_index);
+
+    // Runs the last task of the queue of the worker if it belongs to the
+    // group. The queued tasks of a group a worker waits for are the last
+    // of its queue, as thieves take from the front.
+    bool RunGroupTask(size_t worker_index, const TaskGroup &group);
+
+    void Run(std::stop_token stop_token, size_t worker_index);
+
+    // Returns the index of the calling thread in this pool, or
+    // workers_.size() if it does not belong to it.
+    size_t CurrentWorker() const;
+
+    void Wait(TaskGroup &group);
+};
+
+// Contiguous ranges of indexes keep the per-task overhead independent of
+// count.
+template <typename Function>
+void ThreadPool::ParallelFor(size_t count, Function function)
+{
+    const size_t task_count = std::min(count, ThreadCount() * POOL_TASKS_PER_THREAD);
+    if (task_count == 0)
+    {
+        return;
+    }
+    TaskGroup group(task_count);
+    for (size_t task = 0; task < task_count; ++task)
+    {
+        Submit({[&group, &function, task, task_count, count]() {
+            std::exception_ptr error;
+            try
+            {
+                for (size_t i = count * task / task_count; i < count * (task + 1) / task_count; ++i)
+                {
+                    function(i);
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            group.Finish(error);
+        }, &group});
+    }
+    Wait(group);
+}
+
+// The parallel loops of the server are written against these overloads,
+// so that each runs sequentially, with the standard parallel algorithms or
+// on a pool.
+template <typename Function>
+void ParallelFor(const std::execution::sequenced_policy &, size_t count, Function function)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        function(i);
+    }
+}
+
+// Random access iterator over the indexes of a range, so that the
+// standard parallel algorithms can split it without an index array.
+// Indexes are returned by value.
+class CountingIterator
+{
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = size_t;
+
+    CountingIterator() = default;
+
+    explicit CountingIterator(size_t index)
+        : index_(index)
+    {
+    }
+
+    reference operator*() const
+    {
+        return index_;
+    }
+
+    reference operator[](difference_type offset) const
+    {
+        return index_ + offset;
+    }
+
+    CountingIterator &operator++()
+    {
+        ++index_;
+        return *this;
+    }
+
+    CountingIterator operator++(int)
+    {
+        return CountingIterator(index_++);
+    }
+
+    CountingIterator &operator--()
+    {
+        --index_;
+        return *this;
+    }
+
+    CountingIterator operator--(int)
+    {
+        return CountingIterator(index_--);
+    }
+
+    CountingIterator &operator+=(difference_type offset)
+    {
+        index_ += offset;
+        return *this;
+    }
+
+    CountingIterator &operator-=(difference_type offset)
+    {
+        index_ -= offset;
+        return *this;
+    }
+
+    CountingIterator operator+(difference_type offset) const
+    {
+        return CountingIterator(index_ + offset);
+    }
+
+    friend CountingIterator operator+(difference_type offset, const CountingIterator &it)
+    {
+        return it + offset;
+    }
+
+    CountingIterator operator-(difference_type offset) const
+    {
+        return CountingIterator(index_ - offset);
+    }
+
+    difference_type operator-(const CountingIterator &other) const
+    {
+        return static_cast<difference_type>(index_) - static_cast<difference_type>(other.index_);
+    }
+
+    auto operator<=>(const CountingIterator &other) const = default;
+
+private:
+    size_t index_ = 0;
+};
+
+template <typename Function>
+void ParallelFor(const std::execution::parallel_policy &, size_t count, Function function)
+{
+    std::for_each(std::execution::par, CountingIterator(0), CountingIterator(count), function);
+}
+
+template <typename Function>
+void ParallelFor(const PoolExecutionPolicy &execution_policy, size_t count, Function function)
+{
+    execution_policy.pool->ParallelFor(count, function);
+}
\ No newline at end of file